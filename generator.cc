@@ -2,10 +2,15 @@
 //| Program for semantic analysis and MIPS code generation |
 //----------------------------------------------------------
 
+#include <algorithm>
+#include <climits>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <unordered_set>
 #include <iterator>
+#include <map>
+#include <set>
 #include <sstream>
 #include <tuple>
 #include <unordered_map>
@@ -30,12 +35,6 @@ enum Type {
     UNDEF
 };
 
-enum PartialType {
-    LOCATION,
-    NUMBER,
-    CODE
-};
-
 struct Scope {
     vector<pair<string, Type>> parameters;
     unordered_map<string, tuple<Type, int>> variables;
@@ -63,7 +62,6 @@ struct Node {
     vector<string> tokens;
     vector<Node> children;
     string rule;
-    tuple<string, PartialType> partial = make_tuple("", PartialType::CODE);
     Type type;
     vector<Type> signature;
 };
@@ -75,6 +73,199 @@ unordered_map<string, Type> typeMapping = {
 const string MAIN_PROCEDURE = "main INT WAIN LPAREN dcl COMMA dcl RPAREN LBRACE dcls statements RETURN expr SEMI RBRACE";
 const string PROCEDURE = "procedure INT ID LPAREN params RPAREN LBRACE dcls statements RETURN expr SEMI RBRACE";
 
+// Optimizations are enabled by default, -O0 turns all of them off
+struct Options {
+    bool registerExpressions = true;
+    bool registerVariables = true;
+    bool constantPropagation = true;
+    bool strengthReduction = true;
+    bool deadCodeElimination = true;
+    bool inlining = true;
+    int inlineSize = 40;
+    int inlineGrowth = 2000;
+    bool specialization = true;
+    int specializeGrowth = 400;
+    bool leafProcedures = true;
+    bool tailCalls = true;
+    bool ifConversion = true;
+    bool commonSubexpressions = true;
+    bool aliasAnalysis = true;
+    bool loopInvariants = true;
+    bool inductionVariables = true;
+    bool unrollLoops = true;
+    int unrollFactor = 4;
+    int unrollSize = 48;
+    bool stackSlotColoring = true;
+    bool stackArrays = true;
+    bool registerArguments = true;
+    int stackArrayLimit = 64;
+    bool fusedBranches = true;
+    bool wholeProgram = true;
+    bool instructionSelection = true;
+    bool peephole = true;
+    string peepholeRules = "";
+    bool profileGenerate = false;
+    string profileUse = "";
+    bool report = false;
+} options;
+
+bool isNumber(string value) {
+    int start = !value.empty() && value.at(0) == '-' ? 1 : 0;
+
+    if (start == value.size()) {
+        return false;
+    }
+
+    for (int i = start; i < value.size(); ++i) {
+        if (!isdigit(value.at(i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Execution counts from a profile, by procedure name hash and block hash, and
+// the count of the hottest block
+unordered_map<unsigned long long, long long> profileCounts;
+long long profileMaximum = 0;
+
+inline unsigned long long profileKey(int procedure, int block) {
+    return (static_cast<unsigned long long>(static_cast<unsigned int>(procedure)) << 32) | static_cast<unsigned int>(block);
+}
+
+// Reads the counters an instrumented program prints when wain returns. They
+// come last in its output as triples of procedure hash, block hash and count
+// followed by the number of triples, so the output of a run is the profile
+bool readProfile(string file) {
+    ifstream input(file);
+    vector<long long> values;
+    string token;
+
+    while (input >> token) {
+        if (!isNumber(token) || token.size() > 12) {
+            return false;
+        }
+
+        values.push_back(stoll(token));
+    }
+
+    if (values.empty() || values.back() <= 0 || 3 * values.back() + 1 > values.size()) {
+        return false;
+    }
+
+    for (int i = values.size() - 1 - 3 * values.back(); i < values.size() - 1; i += 3) {
+        long long& count = profileCounts[profileKey(values.at(i), values.at(i + 1))];
+
+        count += values.at(i + 2);
+        profileMaximum = max(profileMaximum, count);
+    }
+
+    return true;
+}
+
+bool readPeepholeRules(string file);
+
+bool parseOptions(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string argument = argv[i];
+
+        if (argument == "-O0") {
+            options.registerExpressions = false;
+            options.registerVariables = false;
+            options.constantPropagation = false;
+            options.strengthReduction = false;
+            options.deadCodeElimination = false;
+            options.inlining = false;
+            options.specialization = false;
+            options.leafProcedures = false;
+            options.tailCalls = false;
+            options.ifConversion = false;
+            options.commonSubexpressions = false;
+            options.aliasAnalysis = false;
+            options.loopInvariants = false;
+            options.inductionVariables = false;
+            options.unrollLoops = false;
+            options.stackSlotColoring = false;
+            options.stackArrays = false;
+            options.registerArguments = false;
+            options.fusedBranches = false;
+            options.wholeProgram = false;
+            options.instructionSelection = false;
+            options.peephole = false;
+        } else if (argument == "-fno-register-expressions") {
+            options.registerExpressions = false;
+            options.registerVariables = false;
+        } else if (argument == "-fno-register-variables") {
+            options.registerVariables = false;
+        } else if (argument == "-fno-constant-propagation") {
+            options.constantPropagation = false;
+        } else if (argument == "-fno-strength-reduction") {
+            options.strengthReduction = false;
+        } else if (argument == "-fno-dead-code-elimination") {
+            options.deadCodeElimination = false;
+        } else if (argument == "-fno-inline") {
+            options.inlining = false;
+        } else if (argument.rfind("-finline-limit=", 0) == 0 && isNumber(argument.substr(15))) {
+            options.inlineSize = stoi(argument.substr(15));
+        } else if (argument.rfind("-finline-growth=", 0) == 0 && isNumber(argument.substr(16))) {
+            options.inlineGrowth = stoi(argument.substr(16));
+        } else if (argument == "-fno-specialize") {
+            options.specialization = false;
+        } else if (argument.rfind("-fspecialize-growth=", 0) == 0 && isNumber(argument.substr(20))) {
+            options.specializeGrowth = stoi(argument.substr(20));
+        } else if (argument == "-fno-leaf-procedures") {
+            options.leafProcedures = false;
+        } else if (argument == "-fno-tail-calls") {
+            options.tailCalls = false;
+        } else if (argument == "-fno-if-conversion") {
+            options.ifConversion = false;
+        } else if (argument == "-fno-common-subexpressions") {
+            options.commonSubexpressions = false;
+        } else if (argument == "-fno-alias-analysis") {
+            options.aliasAnalysis = false;
+        } else if (argument == "-fno-move-loop-invariants") {
+            options.loopInvariants = false;
+        } else if (argument == "-fno-induction-variables") {
+            options.inductionVariables = false;
+        } else if (argument == "-fno-unroll-loops") {
+            options.unrollLoops = false;
+        } else if (argument.rfind("-funroll-factor=", 0) == 0 && isNumber(argument.substr(16))) {
+            options.unrollFactor = stoi(argument.substr(16));
+        } else if (argument.rfind("-funroll-limit=", 0) == 0 && isNumber(argument.substr(15))) {
+            options.unrollSize = stoi(argument.substr(15));
+        } else if (argument == "-fno-stack-slot-coloring") {
+            options.stackSlotColoring = false;
+        } else if (argument == "-fno-stack-arrays") {
+            options.stackArrays = false;
+        } else if (argument.rfind("-fstack-array-limit=", 0) == 0 && isNumber(argument.substr(20))) {
+            options.stackArrayLimit = stoi(argument.substr(20));
+        } else if (argument == "-fno-register-arguments") {
+            options.registerArguments = false;
+        } else if (argument == "-fno-fused-branches") {
+            options.fusedBranches = false;
+        } else if (argument == "-fno-whole-program") {
+            options.wholeProgram = false;
+        } else if (argument == "-fno-instruction-selection") {
+            options.instructionSelection = false;
+        } else if (argument == "-fno-peephole") {
+            options.peephole = false;
+        } else if (argument.rfind("-fpeephole-rules=", 0) == 0 && readPeepholeRules(argument.substr(17))) {
+            options.peepholeRules = argument.substr(17);
+        } else if (argument == "-fprofile-generate") {
+            options.profileGenerate = true;
+        } else if (argument.rfind("-fprofile-use=", 0) == 0 && readProfile(argument.substr(14))) {
+            options.profileUse = argument.substr(14);
+        } else if (argument == "-fopt-info") {
+            options.report = true;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 Node createParseTree(vector<tuple<string, string, vector<string>>>& input, int position, int& childrenCount) {
     tuple<string, string, vector<string>> current = input.at(position);
     int length = get<2>(current).size() - 1;
@@ -462,17 +653,8 @@ inline string labelInstruction(string label) {
     return label + ":\n";
 }
 
-string code(tuple<string, PartialType> partial) {
-    string parameter = get<0>(partial);
-
-    switch (get<1>(partial)) {
-        case PartialType::CODE: return parameter;
-        case PartialType::NUMBER: return loadSkipInstruction("$3", parameter);
-        case PartialType::LOCATION: return loadInstruction("$3", parameter, "$29");
-    }
-}
-
 bool printIncluded = false;
+bool heapIncluded = true;
 int currentLabel = 0;
 
 inline string generateLabel() {
@@ -483,295 +665,6341 @@ inline string generateFunction(string name) {
     return "F" + name;
 }
 
-bool traverseSearchPointer(Node& head) {
-    return head.rule == "lvalue LPAREN lvalue RPAREN" ? traverseSearchPointer(head.children.at(1)) : head.tokens.size() == 3;
+// Operations of the three-address intermediate representation. Pointer forms
+// scale their integer operand by the word size, terminators end a basic block
+enum Opcode {
+    CONSTANT,
+    COPY,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    MODULO,
+    POINTER_ADD,
+    POINTER_SUBTRACT,
+    POINTER_DIFFERENCE,
+    LESS_THAN,
+    LESS_EQUAL,
+    GREATER_THAN,
+    GREATER_EQUAL,
+    EQUAL,
+    NOT_EQUAL,
+    LOAD_LOCAL,
+    STORE_LOCAL,
+    ADDRESS_LOCAL,
+    LOAD,
+    STORE,
+    CALL,
+    NEW,
+    DELETE,
+    PRINT,
+    PROFILE,
+    JUMP,
+    BRANCH,
+    RETURN
+};
+
+// Operands and destination are virtual registers, frame offsets and constants
+// live in the immediate and branch targets are indices of basic blocks. A
+// branch goes to its target when the comparison of its operands holds, with
+// the immediate standing in for a missing second operand. Once instructions
+// are selected, loads and stores add the immediate to their address and
+// pointer arithmetic with one operand takes its index from the immediate
+struct Instruction {
+    Opcode opcode;
+    int destination = -1;
+    vector<int> operands;
+    int immediate = 0;
+    string symbol;
+    int target = -1;
+    int alternative = -1;
+    bool isUnsigned = false;
+    Opcode comparison = Opcode::NOT_EQUAL;
+};
+
+// Blocks keep the number of times they ran in the profile, or -1
+struct BasicBlock {
+    string label;
+    vector<Instruction> instructions;
+    long long count = -1;
+};
+
+struct Procedure {
+    string name;
+    bool isMain;
+    int frameSize;
+    vector<int> parameters;
+    vector<Type> parameterTypes;
+    vector<Type> registers;
+    vector<BasicBlock> blocks;
+    unordered_map<int, int> variableSlots;
+    int sharedBytes = 0;
+};
+
+unordered_map<string, Opcode> operatorMapping = {
+    { "PLUS", Opcode::ADD }, { "MINUS", Opcode::SUBTRACT }, { "STAR", Opcode::MULTIPLY }, 
+    { "SLASH", Opcode::DIVIDE }, { "PCT", Opcode::MODULO }, { "LT", Opcode::LESS_THAN }, 
+    { "LE", Opcode::LESS_EQUAL }, { "GT", Opcode::GREATER_THAN }, { "GE", Opcode::GREATER_EQUAL }, 
+    { "EQ", Opcode::EQUAL }, { "NE", Opcode::NOT_EQUAL }
+};
+
+Instruction createInstruction(Opcode opcode, int destination, vector<int> operands, int immediate = 0) {
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.destination = destination;
+    instruction.operands = operands;
+    instruction.immediate = immediate;
+
+    return instruction;
+}
+
+int newRegister(Procedure& procedure, Type type) {
+    procedure.registers.push_back(type);
+
+    return procedure.registers.size() - 1;
+}
+
+int newBlock(Procedure& procedure) {
+    BasicBlock block;
+    block.label = generateLabel();
+    procedure.blocks.push_back(block);
+
+    return procedure.blocks.size() - 1;
 }
 
-void generateCode(Node& head, unordered_map<string, Scope>& symbols, string scope) {
-    manageScope(head, symbols, scope, 0);
+int appendValue(Procedure& procedure, int block, Opcode opcode, Type type, vector<int> operands, int immediate = 0) {
+    int destination = newRegister(procedure, type);
+    procedure.blocks.at(block).instructions.push_back(createInstruction(opcode, destination, operands, immediate));
+
+    return destination;
+}
+
+void appendEffect(Procedure& procedure, int block, Opcode opcode, vector<int> operands, int immediate = 0) {
+    procedure.blocks.at(block).instructions.push_back(createInstruction(opcode, -1, operands, immediate));
+}
+
+void appendJump(Procedure& procedure, int block, int target) {
+    appendEffect(procedure, block, Opcode::JUMP, {});
+    procedure.blocks.at(block).instructions.back().target = target;
+}
+
+void appendBranch(Procedure& procedure, int block, int condition, int target, int alternative) {
+    appendEffect(procedure, block, Opcode::BRANCH, { condition });
+    procedure.blocks.at(block).instructions.back().target = target;
+    procedure.blocks.at(block).instructions.back().alternative = alternative;
+}
+
+inline int variableOffset(Scope& scope, Node& ID) {
+    return get<1>(scope.variables[ID.tokens.at(1)]);
+}
+
+int lowerExpression(Node& head, Scope& scope, Procedure& procedure, int& block);
+
+bool isPure(Node& head) {
+    if (head.rule == "factor NEW INT LBRACK expr RBRACK" || head.rule == "factor ID LPAREN RPAREN" || head.rule == "factor ID LPAREN arglist RPAREN") {
+        return false;
+    }
 
     for (int i = 0; i < head.children.size(); ++i) {
-        generateCode(head.children.at(i), symbols, scope);
+        if (!isPure(head.children.at(i))) {
+            return false;
+        }
     }
 
-    Scope& currentScope = symbols[scope];
+    return true;
+}
 
-    if (head.rule == MAIN_PROCEDURE) {
-        string partialCode = "";
+// Sethi-Ullman number of an expression, the registers needed to evaluate it
+// without spilling
+int registerNeed(Node& head) {
+    if (head.rule == "expr expr PLUS term" || head.rule == "expr expr MINUS term" || head.rule == "term term STAR factor" 
+        || head.rule == "term term SLASH factor" || head.rule == "term term PCT factor" || head.head == "test") {
+        int left = registerNeed(head.children.at(0));
+        int right = registerNeed(head.children.at(2));
 
-        partialCode += loadSkipInstruction("$4", "4");
-        partialCode += loadSkipInstruction("$11", "1");
-        partialCode += subtractInstruction("$29", "$30", "$4");
-        partialCode += loadSkipInstruction("$12", to_string(currentScope.variablesCount * 4 + 8));
-        partialCode += subtractInstruction("$30", "$30", "$12");
-        partialCode += saveInstruction("$1", get<0>(head.children.at(3).partial), "$29");
-        partialCode += saveInstruction("$2", get<0>(head.children.at(5).partial), "$29");
+        return left == right ? left + 1 : max(left, right);
+    } else if (head.rule == "factor ID LPAREN arglist RPAREN") {
+        int need = 1;
+        int held = 0;
 
-	if (head.children.at(3).children.at(0).tokens.size() == 2) {
-            partialCode += loadSkipInstruction("$2", "0");
+        for (Node* arglist = &head.children.at(2); ; arglist = &arglist->children.at(2)) {
+            need = max(need, held++ + registerNeed(arglist->children.at(0)));
+
+            if (arglist->rule == "arglist expr") {
+                return need;
+            }
         }
+    } else if (head.children.size() == 1) {
+        return head.head == "factor" ? 1 : registerNeed(head.children.at(0));
+    }
 
-        partialCode += importInstruction("init");
-        partialCode += importInstruction("new");
-        partialCode += importInstruction("delete");
-        partialCode += pushInstruction("$31");
-        partialCode += loadSkipInstruction("$10", "init");
-        partialCode += jumpLinkInstruction("$10");
-        partialCode += popInstruction("$31");
-        partialCode += code(head.children.at(8).partial);
-        partialCode += code(head.children.at(9).partial);
-        partialCode += code(head.children.at(11).partial);
-        partialCode += addInstruction("$30", "$29", "$4");
-        partialCode += jumpInstruction("$31");
-
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "dcl type ID") {
-	head.partial = make_pair(to_string(get<1>(currentScope.variables[head.children.at(1).tokens.at(1)])), PartialType::LOCATION);
-    } else if (head.rule == "expr term" || head.rule == "term factor" || head.rule == "procedures main" || head.rule == "arglist expr" || head.rule == "factor NUM" || head.rule == "factor NULL") {
-        head.partial = head.children.at(0).partial;
-    } else if (head.rule == "factor ID" || head.rule == "lvalue ID") {
-        head.partial = make_pair(to_string(get<1>(currentScope.variables[head.children.at(0).tokens.at(1)])), PartialType::LOCATION);
-    } else if (head.rule == "factor LPAREN expr RPAREN" || head.rule == "lvalue LPAREN lvalue RPAREN" || head.rule == "lvalue STAR factor") {
-        head.partial = head.children.at(1).partial;
-    } else if (head.rule == "expr expr PLUS term" || head.rule == "expr expr MINUS term") {
-        string partialCode = "";
+    for (int i = 0; i < head.children.size(); ++i) {
+        if (terminals.find(head.children.at(i).head) == terminals.end()) {
+            return registerNeed(head.children.at(i));
+        }
+    }
 
-        partialCode += code(head.children.at(0).partial);
+    return 1;
+}
 
-        if (head.children.at(2).type == Type::INTSTAR && head.tokens.at(2) == "PLUS") {
-            partialCode += multiplyInstruction("$3", "$4");
-            partialCode += moveLowInstruction("$3");
-        }
+// Evaluates the operand that needs more registers first when neither side
+// has effects, so the other operand is the only value held meanwhile
+void lowerOperands(Node& head, Scope& scope, Procedure& procedure, int& block, int& first, int& second) {
+    Node& left = head.children.at(0);
+    Node& right = head.children.at(2);
+
+    if (options.registerExpressions && registerNeed(right) > registerNeed(left) && isPure(left) && isPure(right)) {
+        second = lowerExpression(right, scope, procedure, block);
+        first = lowerExpression(left, scope, procedure, block);
+    } else {
+        first = lowerExpression(left, scope, procedure, block);
+        second = lowerExpression(right, scope, procedure, block);
+    }
+}
+
+int lowerAddress(Node& head, Scope& scope, Procedure& procedure, int& block) {
+    if (head.rule == "lvalue LPAREN lvalue RPAREN") {
+        return lowerAddress(head.children.at(1), scope, procedure, block);
+    } else if (head.rule == "lvalue STAR factor") {
+        return lowerExpression(head.children.at(1), scope, procedure, block);
+    }
+
+    return appendValue(procedure, block, Opcode::ADDRESS_LOCAL, Type::INTSTAR, {}, variableOffset(scope, head.children.at(0)));
+}
+
+int lowerExpression(Node& head, Scope& scope, Procedure& procedure, int& block) {
+    if (head.rule == "expr term" || head.rule == "term factor" || head.rule == "arglist expr") {
+        return lowerExpression(head.children.at(0), scope, procedure, block);
+    } else if (head.rule == "factor LPAREN expr RPAREN") {
+        return lowerExpression(head.children.at(1), scope, procedure, block);
+    } else if (head.rule == "factor NUM") {
+        return appendValue(procedure, block, Opcode::CONSTANT, Type::INT, {}, stoi(head.children.at(0).tokens.at(1)));
+    } else if (head.rule == "factor NULL") {
+        return appendValue(procedure, block, Opcode::CONSTANT, Type::INTSTAR, {}, 1);
+    } else if (head.rule == "factor ID") {
+        return appendValue(procedure, block, Opcode::LOAD_LOCAL, head.type, {}, variableOffset(scope, head.children.at(0)));
+    } else if (head.rule == "factor AMP lvalue") {
+        return lowerAddress(head.children.at(1), scope, procedure, block);
+    } else if (head.rule == "factor STAR factor") {
+        int address = lowerExpression(head.children.at(1), scope, procedure, block);
+
+        return appendValue(procedure, block, Opcode::LOAD, Type::INT, { address });
+    } else if (head.rule == "factor NEW INT LBRACK expr RBRACK") {
+        int size = lowerExpression(head.children.at(3), scope, procedure, block);
+
+        return appendValue(procedure, block, Opcode::NEW, Type::INTSTAR, { size });
+    } else if (head.rule == "factor ID LPAREN RPAREN" || head.rule == "factor ID LPAREN arglist RPAREN") {
+        vector<int> arguments;
+
+        if (head.children.size() == 4) {
+            Node* arglist = &head.children.at(2);
+
+            while (true) {
+                arguments.push_back(lowerExpression(arglist->children.at(0), scope, procedure, block));
 
-        partialCode += pushInstruction("$3");
-        partialCode += code(head.children.at(2).partial);
+                if (arglist->rule == "arglist expr") {
+                    break;
+                }
 
-        if (head.children.at(0).type == Type::INTSTAR && head.children.at(2).type == Type::INT) {
-            partialCode += multiplyInstruction("$3", "$4");
-            partialCode += moveLowInstruction("$3");
+                arglist = &arglist->children.at(2);
+            }
         }
 
-        partialCode += popInstruction("$5");
-        partialCode += head.tokens.at(2) == "PLUS" ? addInstruction("$3", "$5", "$3") : subtractInstruction("$3", "$5", "$3");
+        int destination = appendValue(procedure, block, Opcode::CALL, Type::INT, arguments);
+        procedure.blocks.at(block).instructions.back().symbol = head.children.at(0).tokens.at(1);
 
-        if (head.tokens.at(2) == "MINUS" && head.children.at(2).type == Type::INTSTAR) {
-            partialCode += divideInstruction("$3", "$4");
-            partialCode += moveLowInstruction("$3");
+        return destination;
+    } else if (head.rule == "expr expr PLUS term" || head.rule == "expr expr MINUS term") {
+        Node& left = head.children.at(0);
+        Node& right = head.children.at(2);
+        int first;
+        int second;
+
+        lowerOperands(head, scope, procedure, block, first, second);
+
+        if (head.tokens.at(2) == "PLUS") {
+            if (left.type == Type::INTSTAR) {
+                return appendValue(procedure, block, Opcode::POINTER_ADD, Type::INTSTAR, { first, second });
+            } else if (right.type == Type::INTSTAR) {
+                return appendValue(procedure, block, Opcode::POINTER_ADD, Type::INTSTAR, { second, first });
+            }
+
+            return appendValue(procedure, block, Opcode::ADD, Type::INT, { first, second });
+        }
+
+        if (left.type == Type::INTSTAR && right.type == Type::INT) {
+            return appendValue(procedure, block, Opcode::POINTER_SUBTRACT, Type::INTSTAR, { first, second });
+        } else if (left.type == Type::INTSTAR) {
+            return appendValue(procedure, block, Opcode::POINTER_DIFFERENCE, Type::INT, { first, second });
         }
 
-        head.partial = make_tuple(partialCode, PartialType::CODE);
+        return appendValue(procedure, block, Opcode::SUBTRACT, Type::INT, { first, second });
     } else if (head.rule == "term term STAR factor" || head.rule == "term term SLASH factor" || head.rule == "term term PCT factor") {
-        string partialCode = "";
+        int first;
+        int second;
 
-        partialCode += code(head.children.at(0).partial);
-        partialCode += pushInstruction("$3");
-        partialCode += code(head.children.at(2).partial);
-        partialCode += popInstruction("$5");
-        partialCode += head.tokens.at(2) == "STAR" ? multiplyInstruction("$5", "$3") : divideInstruction("$5", "$3");
-        partialCode += head.tokens.at(2) == "PCT" ? moveHighInstruction("$3") : moveLowInstruction("$3");
+        lowerOperands(head, scope, procedure, block, first, second);
 
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "statements statements statement") {
-        head.partial = make_tuple(code(head.children.at(0).partial) + code(head.children.at(1).partial), PartialType::CODE);
-    } else if (head.rule == "statement PRINTLN LPAREN expr RPAREN SEMI") {
-        string partialCode = "";
+        return appendValue(procedure, block, operatorMapping[head.tokens.at(2)], Type::INT, { first, second });
+    } else if (head.head == "test") {
+        int first;
+        int second;
 
-        if (!printIncluded) {
-            partialCode += importInstruction("print");
-            printIncluded = true;
-        }
+        lowerOperands(head, scope, procedure, block, first, second);
+        int destination = appendValue(procedure, block, operatorMapping[head.tokens.at(2)], Type::INT, { first, second });
 
-        partialCode += code(head.children.at(2).partial);
-        partialCode += addInstruction("$1", "$3", "$0");
-        partialCode += pushInstruction("$31");
-        partialCode += loadSkipInstruction("$10", "print");
-        partialCode += jumpLinkInstruction("$10");
-        partialCode += popInstruction("$31");
+        procedure.blocks.at(block).instructions.back().isUnsigned = head.children.at(0).type == Type::INTSTAR;
 
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "statement lvalue BECOMES expr SEMI") {
-        string partialCode = code(head.children.at(2).partial);
+        return destination;
+    }
 
-        if (traverseSearchPointer(head.children.at(0))) { 
-            partialCode += pushInstruction("$3");
-            partialCode += code(head.children.at(0).partial);
-            partialCode += popInstruction("$5");
-            partialCode += saveInstruction("$5", "0", "$3");
-        } else {
-            partialCode += saveInstruction("$3", get<0>(head.children.at(0).partial), "$29");
-        }
+    return -1;
+}
 
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "dcls dcls dcl BECOMES NUM SEMI" || head.rule == "dcls dcls dcl BECOMES NULL SEMI") {
-        head.partial = make_tuple(code(head.children.at(0).partial) + code(head.children.at(3).partial) + saveInstruction("$3", get<0>(head.children.at(1).partial), "$29"), PartialType::CODE);
-    } else if (head.head == "NUM") {
-        head.partial = make_tuple(head.tokens.at(1), PartialType::NUMBER);
-    } else if (head.rule == "test expr LT expr" || head.rule == "test expr GT expr" || head.rule == "test expr GE expr" || head.rule == "test expr LE expr") {
-        string partialCode = "";
+void lowerStatements(Node& head, Scope& scope, Procedure& procedure, int& block);
 
-        partialCode += code(head.children.at(0).partial);
-        partialCode += pushInstruction("$3");
-        partialCode += code(head.children.at(2).partial);
-        partialCode += popInstruction("$5");
+void lowerStatement(Node& head, Scope& scope, Procedure& procedure, int& block) {
+    if (head.rule == "statement lvalue BECOMES expr SEMI") {
+        int value = lowerExpression(head.children.at(2), scope, procedure, block);
+        Node* lvalue = &head.children.at(0);
 
-        if (head.tokens.at(2) == "LT" || head.tokens.at(2) == "GE") {
-            partialCode += head.children.at(0).type == Type::INTSTAR ? setLessThanUnsignedInstruction("$3", "$5", "$3") : setLessThanInstruction("$3", "$5", "$3");
-        } else {
-            partialCode += head.children.at(0).type == Type::INTSTAR ? setLessThanUnsignedInstruction("$3", "$3", "$5") : setLessThanInstruction("$3", "$3", "$5");
+        while (lvalue->rule == "lvalue LPAREN lvalue RPAREN") {
+            lvalue = &lvalue->children.at(1);
         }
 
-        if (head.tokens.at(2) == "GE" || head.tokens.at(2) == "LE") {
-            partialCode += subtractInstruction("$3", "$11", "$3");
+        if (lvalue->rule == "lvalue ID") {
+            appendEffect(procedure, block, Opcode::STORE_LOCAL, { value }, variableOffset(scope, lvalue->children.at(0)));
+        } else {
+            int address = lowerExpression(lvalue->children.at(1), scope, procedure, block);
+            appendEffect(procedure, block, Opcode::STORE, { address, value });
         }
-
-        head.partial = make_tuple(partialCode, PartialType::CODE);
+    } else if (head.rule == "statement PRINTLN LPAREN expr RPAREN SEMI") {
+        appendEffect(procedure, block, Opcode::PRINT, { lowerExpression(head.children.at(2), scope, procedure, block) });
+    } else if (head.rule == "statement DELETE LBRACK RBRACK expr SEMI") {
+        appendEffect(procedure, block, Opcode::DELETE, { lowerExpression(head.children.at(3), scope, procedure, block) });
     } else if (head.rule == "statement WHILE LPAREN test RPAREN LBRACE statements RBRACE") {
-        string partialCode = "";
-        string labelOne = generateLabel();
-        string labelTwo = generateLabel();
-
-        partialCode += labelInstruction(labelOne);
-        partialCode += code(head.children.at(2).partial);
-        partialCode += branchEqualInstruction("$3", "$0", labelTwo);
-        partialCode += code(head.children.at(5).partial);
-        partialCode += branchEqualInstruction("$0", "$0", labelOne);
-        partialCode += labelInstruction(labelTwo);
-
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "test expr NE expr" || head.rule == "test expr EQ expr") {
-        string partialCode = "";
+        int header = newBlock(procedure);
+        appendJump(procedure, block, header);
+        block = header;
 
-        partialCode += code(head.children.at(0).partial);
-        partialCode += pushInstruction("$3");
-        partialCode += code(head.children.at(2).partial);
-        partialCode += popInstruction("$5");
-        partialCode += head.children.at(0).type == Type::INT ? setLessThanUnsignedInstruction("$6", "$3", "$5") : setLessThanInstruction("$6", "$3", "$5");
-        partialCode += head.children.at(0).type == Type::INT ? setLessThanUnsignedInstruction("$7", "$5", "$3") : setLessThanInstruction("$7", "$5", "$3");
-        partialCode += addInstruction("$3", "$6", "$7");
+        int condition = lowerExpression(head.children.at(2), scope, procedure, block);
+        int body = newBlock(procedure);
+        int test = block;
 
-        if (head.tokens.at(2) == "EQ") {
-            partialCode += subtractInstruction("$3", "$11", "$3");
-        }
+        block = body;
+        lowerStatements(head.children.at(5), scope, procedure, block);
+        appendJump(procedure, block, header);
 
-        head.partial = make_tuple(partialCode, PartialType::CODE);
+        block = newBlock(procedure);
+        appendBranch(procedure, test, condition, body, block);
     } else if (head.rule == "statement IF LPAREN test RPAREN LBRACE statements RBRACE ELSE LBRACE statements RBRACE") {
-        string partialCode = "";
-        string labelOne = generateLabel();
-        string labelTwo = generateLabel();
-
-        partialCode += code(head.children.at(2).partial);
-        partialCode += branchEqualInstruction("$3", "$0", labelOne);
-        partialCode += code(head.children.at(5).partial);
-        partialCode += branchEqualInstruction("$0", "$0", labelTwo);
-        partialCode += labelInstruction(labelOne);
-        partialCode += code(head.children.at(9).partial);
-        partialCode += labelInstruction(labelTwo);
-
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "factor STAR factor") {
-        head.partial = make_tuple(code(head.children.at(1).partial) + loadInstruction("$3", "0", "$3"), PartialType::CODE);
-    } else if (head.head == "NULL") {
-        head.partial = make_tuple(addInstruction("$3", "$0", "$11"), PartialType::CODE);
-    } else if (head.rule == "factor AMP lvalue") {
-        string partialCode = "";
+        int condition = lowerExpression(head.children.at(2), scope, procedure, block);
+        int test = block;
+        int thenBlock = newBlock(procedure);
 
-		if (get<1>(head.children.at(1).partial) == PartialType::LOCATION) {
-			partialCode += loadSkipInstruction("$3", get<0>(head.children.at(1).partial));
-			partialCode += addInstruction("$3", "$3", "$29");
-		}
-		else {
-			partialCode += code(head.children.at(1).children.at(1).partial);
-		}
+        block = thenBlock;
+        lowerStatements(head.children.at(5), scope, procedure, block);
 
-		head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "factor NEW INT LBRACK expr RBRACK" || head.rule == "statement DELETE LBRACK RBRACK expr SEMI") {
-        string partialCode = "";
-        string label = "";
-        
-        partialCode += code(head.children.at(3).partial);
+        int thenEnd = block;
+        int elseBlock = newBlock(procedure);
 
-        if (head.tokens.at(1) == "DELETE") {
-            label = generateLabel();
-            partialCode += branchEqualInstruction("$3", "$11", label);
-        }
-        
-        partialCode += addInstruction("$1", "$0", "$3");
-        partialCode += pushInstruction("$31");
-        partialCode += loadSkipInstruction("$10", head.tokens.at(1) == "NEW" ? "new" : "delete");
-        partialCode += jumpLinkInstruction("$10");
-        partialCode += popInstruction("$31");
+        block = elseBlock;
+        lowerStatements(head.children.at(9), scope, procedure, block);
 
-        if (head.tokens.at(1) == "NEW") {
-            partialCode += branchNotEqualInstruction("$3", "$0", "1");
-            partialCode += addInstruction("$3", "$0", "$11");
-        } else {
-            partialCode += labelInstruction(label);
+        int elseEnd = block;
+
+        block = newBlock(procedure);
+        appendBranch(procedure, test, condition, thenBlock, elseBlock);
+        appendJump(procedure, thenEnd, block);
+        appendJump(procedure, elseEnd, block);
+    }
+}
+
+void lowerStatements(Node& head, Scope& scope, Procedure& procedure, int& block) {
+    if (head.rule == "statements statements statement") {
+        lowerStatements(head.children.at(0), scope, procedure, block);
+        lowerStatement(head.children.at(1), scope, procedure, block);
+    }
+}
+
+void lowerDeclarations(Node& head, Scope& scope, Procedure& procedure, int& block) {
+    if (head.rule == "dcls dcls dcl BECOMES NUM SEMI" || head.rule == "dcls dcls dcl BECOMES NULL SEMI") {
+        lowerDeclarations(head.children.at(0), scope, procedure, block);
+
+        int value = head.children.at(3).head == "NUM" 
+            ? appendValue(procedure, block, Opcode::CONSTANT, Type::INT, {}, stoi(head.children.at(3).tokens.at(1))) 
+            : appendValue(procedure, block, Opcode::CONSTANT, Type::INTSTAR, {}, 1);
+
+        appendEffect(procedure, block, Opcode::STORE_LOCAL, { value }, variableOffset(scope, head.children.at(1).children.at(1)));
+    }
+}
+
+Procedure lowerProcedure(Node& head, unordered_map<string, Scope>& symbols) {
+    Procedure procedure;
+    procedure.isMain = head.rule == MAIN_PROCEDURE;
+    procedure.name = procedure.isMain ? "wain" : head.children.at(1).tokens.at(1);
+
+    Scope& scope = symbols[procedure.name];
+    int dcls = procedure.isMain ? 8 : 6;
+
+    procedure.frameSize = scope.locationCount * 4;
+
+    if (procedure.isMain) {
+        for (int i = 3; i <= 5; i += 2) {
+            procedure.parameters.push_back(variableOffset(scope, head.children.at(i).children.at(1)));
+            procedure.parameterTypes.push_back(typeMapping[head.children.at(i).children.at(0).rule]);
+        }
+    } else {
+        for (int i = 0; i < scope.parameters.size(); ++i) {
+            procedure.parameters.push_back(get<1>(scope.variables[scope.parameters.at(i).first]));
+            procedure.parameterTypes.push_back(scope.parameters.at(i).second);
         }
+    }
 
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == PROCEDURE) {
-        string partialCode = "";
-        
-        partialCode += labelInstruction(generateFunction(head.children.at(1).tokens.at(1)));
-        partialCode += subtractInstruction("$29", "$30", "$4");
-        partialCode += loadSkipInstruction("$12", to_string(currentScope.variablesCount * 4));
-        partialCode += subtractInstruction("$30", "$30", "$12");
-        partialCode += code(head.children.at(6).partial);
-        partialCode += code(head.children.at(7).partial);
-        partialCode += code(head.children.at(9).partial);
-        partialCode += addInstruction("$30", "$29", "$4");
-        partialCode += jumpInstruction("$31");
-
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "procedures procedure procedures") {
-        head.partial = make_tuple(code(head.children.at(1).partial) + code(head.children.at(0).partial), PartialType::CODE);
-    } else if (head.rule == "factor ID LPAREN RPAREN" || head.rule == "factor ID LPAREN arglist RPAREN") {
-        string partialCode = "";
-        
-        partialCode += pushInstruction("$29");
-        partialCode += pushInstruction("$31");
-        
-        if (head.tokens.size() == 5) {
-            partialCode += code(head.children.at(2).partial);
-            partialCode += pushInstruction("$3");
+    int block = newBlock(procedure);
+
+    lowerDeclarations(head.children.at(dcls), scope, procedure, block);
+    lowerStatements(head.children.at(dcls + 1), scope, procedure, block);
+    appendEffect(procedure, block, Opcode::RETURN, { lowerExpression(head.children.at(dcls + 3), scope, procedure, block) });
+
+    return procedure;
+}
+
+void lowerProcedures(Node& head, unordered_map<string, Scope>& symbols, vector<Procedure>& procedures) {
+    if (head.rule == "procedures procedure procedures") {
+        procedures.push_back(lowerProcedure(head.children.at(0), symbols));
+        lowerProcedures(head.children.at(1), symbols, procedures);
+    } else if (head.rule == "procedures main") {
+        procedures.push_back(lowerProcedure(head.children.at(0), symbols));
+    }
+}
+
+vector<int> successors(BasicBlock& block) {
+    Instruction& terminator = block.instructions.back();
+
+    if (terminator.opcode == Opcode::JUMP) {
+        return { terminator.target };
+    } else if (terminator.opcode == Opcode::BRANCH) {
+        return { terminator.target, terminator.alternative };
+    }
+
+    return {};
+}
+
+struct ControlFlowGraph {
+    vector<vector<int>> successors;
+    vector<vector<int>> predecessors;
+};
+
+ControlFlowGraph buildControlFlowGraph(Procedure& procedure) {
+    ControlFlowGraph graph;
+    int length = procedure.blocks.size();
+
+    graph.successors.assign(length, vector<int>());
+    graph.predecessors.assign(length, vector<int>());
+
+    for (int i = 0; i < length; ++i) {
+        graph.successors.at(i) = successors(procedure.blocks.at(i));
+
+        for (int successor : graph.successors.at(i)) {
+            graph.predecessors.at(successor).push_back(i);
         }
+    }
 
-        partialCode += loadSkipInstruction("$10", generateFunction(head.children.at(0).tokens.at(1)));
-        partialCode += jumpLinkInstruction("$10");
-        
-        if (head.tokens.size() == 5) {
-            int argumentCount = countCommas(head.children.at(2)) + 1;
+    return graph;
+}
 
-            partialCode += loadSkipInstruction("$12", to_string(4 * argumentCount));
-            partialCode += addInstruction("$30", "$30", "$12");
+struct Liveness {
+    vector<set<int>> liveIn;
+    vector<set<int>> liveOut;
+};
+
+// Iterates the backward dataflow equations over the blocks until the virtual
+// registers live on entry to and exit from every block stop changing
+Liveness computeLiveness(Procedure& procedure) {
+    Liveness liveness;
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    int length = procedure.blocks.size();
+    vector<set<int>> uses(length);
+    vector<set<int>> definitions(length);
+    bool changed = true;
+
+    for (int i = 0; i < length; ++i) {
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            for (int operand : instruction.operands) {
+                if (definitions.at(i).find(operand) == definitions.at(i).end()) {
+                    uses.at(i).insert(operand);
+                }
+            }
+
+            if (instruction.destination != -1) {
+                definitions.at(i).insert(instruction.destination);
+            }
         }
+    }
 
-        partialCode += popInstruction("$31");
-        partialCode += popInstruction("$29");
+    liveness.liveIn.assign(length, set<int>());
+    liveness.liveOut.assign(length, set<int>());
 
-        head.partial = make_tuple(partialCode, PartialType::CODE);
-    } else if (head.rule == "arglist expr COMMA arglist") {
-        head.partial = make_tuple(code(head.children.at(0).partial) + pushInstruction("$3") + code(head.children.at(2).partial), PartialType::CODE);
-    } else if (head.rule == "start BOF procedures EOF") {
-        output(code(head.children.at(1).partial));
+    while (changed) {
+        changed = false;
+
+        for (int i = length - 1; i >= 0; --i) {
+            set<int> liveOut;
+
+            for (int successor : graph.successors.at(i)) {
+                liveOut.insert(liveness.liveIn.at(successor).begin(), liveness.liveIn.at(successor).end());
+            }
+
+            set<int> liveIn = uses.at(i);
+
+            for (int value : liveOut) {
+                if (definitions.at(i).find(value) == definitions.at(i).end()) {
+                    liveIn.insert(value);
+                }
+            }
+
+            if (liveIn != liveness.liveIn.at(i) || liveOut != liveness.liveOut.at(i)) {
+                liveness.liveIn.at(i) = liveIn;
+                liveness.liveOut.at(i) = liveOut;
+                changed = true;
+            }
+        }
     }
- }
 
-int main() {
-    vector<tuple<string, string, vector<string>>> input = acquireInput();
-    unordered_map<string, Scope> symbols;
+    return liveness;
+}
 
-    if (input.size() == 0) {
-        return 0;
+// Every instruction with a destination is a definition, numbered in program
+// order. The sets hold the definitions that reach the entry and exit of blocks
+struct ReachingDefinitions {
+    vector<pair<int, int>> positions;
+    vector<vector<int>> numbers;
+    vector<set<int>> reachIn;
+    vector<set<int>> reachOut;
+};
+
+// Iterates the forward dataflow equations until the definitions reaching every
+// block stop changing
+ReachingDefinitions computeReachingDefinitions(Procedure& procedure) {
+    ReachingDefinitions reaching;
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    int length = procedure.blocks.size();
+    vector<vector<int>> registerDefinitions(procedure.registers.size());
+    vector<unordered_map<int, int>> generated(length);
+    bool changed = true;
+
+    reaching.numbers.assign(length, vector<int>());
+
+    for (int i = 0; i < length; ++i) {
+        vector<Instruction>& instructions = procedure.blocks.at(i).instructions;
+
+        for (int j = 0; j < instructions.size(); ++j) {
+            int number = -1;
+
+            if (instructions.at(j).destination != -1) {
+                number = reaching.positions.size();
+                reaching.positions.push_back({ i, j });
+                registerDefinitions.at(instructions.at(j).destination).push_back(number);
+                generated.at(i)[instructions.at(j).destination] = number;
+            }
+
+            reaching.numbers.at(i).push_back(number);
+        }
     }
 
-    int childrenCount = 0;
-    Node parseTree = createParseTree(input, 0, childrenCount);
+    reaching.reachIn.assign(length, set<int>());
+    reaching.reachOut.assign(length, set<int>());
 
-    if (checkDeclaration(parseTree, symbols, "", false, 0)) {
-        if (checkUndeclared(parseTree, symbols, "")) {
-            if (checkType(parseTree, symbols, "")) {
-                generateCode(parseTree, symbols, "");
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < length; ++i) {
+            set<int> reachIn;
+
+            for (int predecessor : graph.predecessors.at(i)) {
+                reachIn.insert(reaching.reachOut.at(predecessor).begin(), reaching.reachOut.at(predecessor).end());
+            }
+
+            set<int> reachOut;
+
+            for (int number : reachIn) {
+                pair<int, int> position = reaching.positions.at(number);
+                int value = procedure.blocks.at(position.first).instructions.at(position.second).destination;
+
+                if (generated.at(i).find(value) == generated.at(i).end()) {
+                    reachOut.insert(number);
+                }
+            }
+
+            for (auto& definition : generated.at(i)) {
+                reachOut.insert(definition.second);
+            }
+
+            if (reachIn != reaching.reachIn.at(i) || reachOut != reaching.reachOut.at(i)) {
+                reaching.reachIn.at(i) = reachIn;
+                reaching.reachOut.at(i) = reachOut;
+                changed = true;
+            }
+        }
+    }
+
+    return reaching;
+}
+
+// Definitions of a virtual register that reach the given instruction
+vector<int> reachingDefinitions(Procedure& procedure, ReachingDefinitions& reaching, int block, int index, int value) {
+    vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+    vector<int> definitions;
+
+    for (int i = index - 1; i >= 0; --i) {
+        if (instructions.at(i).destination == value) {
+            return { reaching.numbers.at(block).at(i) };
+        }
+    }
+
+    for (int number : reaching.reachIn.at(block)) {
+        pair<int, int> position = reaching.positions.at(number);
+
+        if (procedure.blocks.at(position.first).instructions.at(position.second).destination == value) {
+            definitions.push_back(number);
+        }
+    }
+
+    return definitions;
+}
+
+// Immediate dominator of every block, found by intersecting the dominators of
+// its predecessors in reverse postorder until nothing changes. The entry is its
+// own dominator and blocks that cannot be reached have none
+vector<int> computeDominators(Procedure& procedure) {
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    int length = procedure.blocks.size();
+    vector<int> postorder;
+    vector<int> numbers(length, -1);
+    vector<bool> visited(length, false);
+    vector<pair<int, int>> stack = { { 0, 0 } };
+    vector<int> dominators(length, -1);
+    bool changed = true;
+
+    visited.at(0) = true;
+
+    while (!stack.empty()) {
+        int current = stack.back().first;
+        int next = stack.back().second++;
+
+        if (next < graph.successors.at(current).size()) {
+            int successor = graph.successors.at(current).at(next);
+
+            if (!visited.at(successor)) {
+                visited.at(successor) = true;
+                stack.push_back({ successor, 0 });
+            }
+        } else {
+            numbers.at(current) = postorder.size();
+            postorder.push_back(current);
+            stack.pop_back();
+        }
+    }
+
+    dominators.at(0) = 0;
+
+    while (changed) {
+        changed = false;
+
+        for (int i = postorder.size() - 1; i >= 0; --i) {
+            int block = postorder.at(i);
+            int dominator = -1;
+
+            if (block == 0) {
+                continue;
+            }
+
+            for (int predecessor : graph.predecessors.at(block)) {
+                if (dominators.at(predecessor) == -1) {
+                    continue;
+                } else if (dominator == -1) {
+                    dominator = predecessor;
+                    continue;
+                }
+
+                int other = predecessor;
+
+                while (dominator != other) {
+                    while (numbers.at(dominator) < numbers.at(other)) {
+                        dominator = dominators.at(dominator);
+                    }
+
+                    while (numbers.at(other) < numbers.at(dominator)) {
+                        other = dominators.at(other);
+                    }
+                }
+            }
+
+            if (dominator != dominators.at(block)) {
+                dominators.at(block) = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    return dominators;
+}
+
+bool dominates(vector<int>& dominators, int first, int second) {
+    while (second != first && second > 0) {
+        second = dominators.at(second);
+    }
+
+    return second == first;
+}
+
+struct Loop {
+    int header;
+    set<int> blocks;
+};
+
+// Natural loops, one per header and innermost first. An edge into a block that
+// dominates its source closes a loop holding every block that reaches the
+// source without passing through the header
+vector<Loop> findLoops(Procedure& procedure) {
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    vector<int> dominators = computeDominators(procedure);
+    unordered_map<int, Loop> headers;
+    vector<Loop> loops;
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (int successor : graph.successors.at(i)) {
+            if (dominators.at(i) == -1 || !dominates(dominators, successor, i)) {
+                continue;
+            }
+
+            Loop& loop = headers[successor];
+            vector<int> worklist = { i };
+
+            loop.header = successor;
+            loop.blocks.insert(successor);
+
+            while (!worklist.empty()) {
+                int current = worklist.back();
+                worklist.pop_back();
+
+                if (loop.blocks.insert(current).second) {
+                    worklist.insert(worklist.end(), graph.predecessors.at(current).begin(), graph.predecessors.at(current).end());
+                }
+            }
+        }
+    }
+
+    for (auto& entry : headers) {
+        loops.push_back(entry.second);
+    }
+
+    sort(loops.begin(), loops.end(), [](Loop& first, Loop& second) {
+        return first.blocks.size() < second.blocks.size() || (first.blocks.size() == second.blocks.size() && first.header < second.header);
+    });
+
+    return loops;
+}
+
+// Moves locals and parameters whose address is never taken out of their frame
+// slots into virtual registers. Loads become uses of the variable, and a store
+// retargets the instruction that computed the stored value when it can
+void promoteVariables(Procedure& procedure) {
+    unordered_set<int> addressed;
+    unordered_map<int, int> variables;
+    unordered_map<int, int> replacements;
+    vector<int> useCounts(procedure.registers.size(), 0);
+    vector<Instruction> parameters;
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.opcode == Opcode::ADDRESS_LOCAL) {
+                addressed.insert(instruction.immediate);
+            }
+
+            for (int operand : instruction.operands) {
+                ++useCounts.at(operand);
+            }
+        }
+    }
+
+    auto variableAt = [&](int offset, Type type) {
+        if (variables.find(offset) == variables.end()) {
+            variables[offset] = newRegister(procedure, type);
+            procedure.variableSlots[variables[offset]] = offset;
+        }
+
+        return variables[offset];
+    };
+
+    for (int i = 0; i < procedure.parameters.size(); ++i) {
+        if (addressed.find(procedure.parameters.at(i)) == addressed.end()) {
+            int variable = variableAt(procedure.parameters.at(i), procedure.parameterTypes.at(i));
+            parameters.push_back(createInstruction(Opcode::LOAD_LOCAL, variable, {}, procedure.parameters.at(i)));
+        }
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        vector<Instruction> instructions;
+
+        for (Instruction& instruction : block.instructions) {
+            for (int& operand : instruction.operands) {
+                if (replacements.find(operand) != replacements.end()) {
+                    operand = replacements[operand];
+                }
+            }
+
+            if (instruction.opcode == Opcode::LOAD_LOCAL && addressed.find(instruction.immediate) == addressed.end()) {
+                replacements[instruction.destination] = variableAt(instruction.immediate, procedure.registers.at(instruction.destination));
+            } else if (instruction.opcode == Opcode::STORE_LOCAL && addressed.find(instruction.immediate) == addressed.end()) {
+                int value = instruction.operands.at(0);
+                int variable = variableAt(instruction.immediate, procedure.registers.at(value));
+
+                if (!instructions.empty() && instructions.back().destination == value && value < useCounts.size() && useCounts.at(value) == 1 
+                    && procedure.variableSlots.find(value) == procedure.variableSlots.end()) {
+                    instructions.back().destination = variable;
+                } else {
+                    instructions.push_back(createInstruction(Opcode::COPY, variable, { value }));
+                }
+            } else {
+                instructions.push_back(instruction);
+            }
+        }
+
+        block.instructions = instructions;
+    }
+
+    procedure.blocks.at(0).instructions.insert(procedure.blocks.at(0).instructions.begin(), parameters.begin(), parameters.end());
+}
+
+bool isTerminator(Instruction& instruction) {
+    return instruction.opcode == Opcode::JUMP || instruction.opcode == Opcode::BRANCH || instruction.opcode == Opcode::RETURN;
+}
+
+// Whether removing the instruction could change what the program does, which
+// includes loads and divisions that may fault
+bool hasSideEffects(Instruction& instruction) {
+    switch (instruction.opcode) {
+        case Opcode::STORE_LOCAL:
+        case Opcode::STORE:
+        case Opcode::LOAD:
+        case Opcode::DIVIDE:
+        case Opcode::MODULO:
+        case Opcode::CALL:
+        case Opcode::NEW:
+        case Opcode::DELETE:
+        case Opcode::PRINT:
+        case Opcode::PROFILE:
+            return true;
+
+        default:
+            return isTerminator(instruction);
+    }
+}
+
+// Removes instructions without side effects whose results are never read
+void removeUnusedValues(Procedure& procedure) {
+    bool changed = true;
+
+    while (changed) {
+        vector<int> useCounts(procedure.registers.size(), 0);
+        changed = false;
+
+        for (BasicBlock& block : procedure.blocks) {
+            for (Instruction& instruction : block.instructions) {
+                for (int operand : instruction.operands) {
+                    ++useCounts.at(operand);
+                }
+            }
+        }
+
+        for (BasicBlock& block : procedure.blocks) {
+            for (int i = 0; i < block.instructions.size(); ++i) {
+                Instruction& instruction = block.instructions.at(i);
+
+                if (!hasSideEffects(instruction) && instruction.destination != -1 && useCounts.at(instruction.destination) == 0) {
+                    block.instructions.erase(block.instructions.begin() + i--);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// Drops blocks that cannot be reached from the entry and renumbers the targets
+void removeUnreachableBlocks(Procedure& procedure) {
+    vector<int> mapping(procedure.blocks.size(), -1);
+    vector<int> worklist = { 0 };
+    vector<BasicBlock> blocks;
+
+    mapping.at(0) = 0;
+
+    while (!worklist.empty()) {
+        int current = worklist.back();
+        worklist.pop_back();
+
+        for (int successor : successors(procedure.blocks.at(current))) {
+            if (mapping.at(successor) == -1) {
+                mapping.at(successor) = 0;
+                worklist.push_back(successor);
+            }
+        }
+    }
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        if (mapping.at(i) != -1) {
+            mapping.at(i) = blocks.size();
+            blocks.push_back(procedure.blocks.at(i));
+        }
+    }
+
+    for (BasicBlock& block : blocks) {
+        Instruction& terminator = block.instructions.back();
+
+        if (terminator.target != -1) {
+            terminator.target = mapping.at(terminator.target);
+        }
+
+        if (terminator.alternative != -1) {
+            terminator.alternative = mapping.at(terminator.alternative);
+        }
+    }
+
+    procedure.blocks = blocks;
+}
+
+enum ConstantKind {
+    UNKNOWN,
+    KNOWN,
+    VARYING
+};
+
+struct ConstantValue {
+    ConstantKind kind = ConstantKind::UNKNOWN;
+    int value = 0;
+
+    bool operator==(const ConstantValue& other) const {
+        return kind == other.kind && (kind != ConstantKind::KNOWN || value == other.value);
+    }
+};
+
+ConstantValue knownValue(int value) {
+    ConstantValue constant;
+    constant.kind = ConstantKind::KNOWN;
+    constant.value = value;
+
+    return constant;
+}
+
+ConstantValue meetValues(ConstantValue first, ConstantValue second) {
+    if (first.kind == ConstantKind::UNKNOWN) {
+        return second;
+    } else if (second.kind == ConstantKind::UNKNOWN || first == second) {
+        return first;
+    }
+
+    ConstantValue varying;
+    varying.kind = ConstantKind::VARYING;
+
+    return varying;
+}
+
+// Computes an operation on 32 bit words the way the machine does, refusing the
+// divisions whose runtime behaviour has to be kept
+bool evaluateOperation(Opcode opcode, bool isUnsigned, int first, int second, int& result) {
+    unsigned int left = first;
+    unsigned int right = second;
+
+    switch (opcode) {
+        case Opcode::ADD: result = left + right; return true;
+        case Opcode::SUBTRACT: result = left - right; return true;
+        case Opcode::MULTIPLY: result = left * right; return true;
+        case Opcode::POINTER_ADD: result = left + right * 4; return true;
+        case Opcode::POINTER_SUBTRACT: result = left - right * 4; return true;
+        case Opcode::POINTER_DIFFERENCE: result = (int)(left - right) / 4; return true;
+        case Opcode::LESS_THAN: result = isUnsigned ? left < right : first < second; return true;
+        case Opcode::LESS_EQUAL: result = isUnsigned ? left <= right : first <= second; return true;
+        case Opcode::GREATER_THAN: result = isUnsigned ? left > right : first > second; return true;
+        case Opcode::GREATER_EQUAL: result = isUnsigned ? left >= right : first >= second; return true;
+        case Opcode::EQUAL: result = first == second; return true;
+        case Opcode::NOT_EQUAL: result = first != second; return true;
+
+        case Opcode::DIVIDE:
+        case Opcode::MODULO:
+            if (second == 0 || (first == INT_MIN && second == -1)) {
+                return false;
+            }
+
+            result = opcode == Opcode::DIVIDE ? first / second : first % second;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Value of the destination given what is known about the operands. Identities
+// such as multiplying by zero hold even when the other operand varies
+ConstantValue transferConstant(Instruction& instruction, vector<ConstantValue>& values) {
+    ConstantValue varying;
+    varying.kind = ConstantKind::VARYING;
+
+    if (instruction.opcode == Opcode::CONSTANT) {
+        return knownValue(instruction.immediate);
+    } else if (instruction.opcode == Opcode::COPY) {
+        return values.at(instruction.operands.at(0));
+    } else if (instruction.operands.size() != 2 || instruction.opcode == Opcode::CALL) {
+        return varying;
+    }
+
+    ConstantValue first = values.at(instruction.operands.at(0));
+    ConstantValue second = values.at(instruction.operands.at(1));
+
+    // Absorbing operands drop an operand whose load or division stays behind for
+    // its side effects, which the stack emitter would push and never pop
+    bool isAbsorbing = options.registerExpressions;
+
+    if (isAbsorbing && instruction.opcode == Opcode::MULTIPLY && ((first.kind == ConstantKind::KNOWN && first.value == 0) || (second.kind == ConstantKind::KNOWN && second.value == 0))) {
+        return knownValue(0);
+    } else if (isAbsorbing && instruction.opcode == Opcode::MODULO && second.kind == ConstantKind::KNOWN && (second.value == 1 || second.value == -1)) {
+        return knownValue(0);
+    } else if (first.kind == ConstantKind::UNKNOWN || second.kind == ConstantKind::UNKNOWN) {
+        return first.kind == ConstantKind::VARYING || second.kind == ConstantKind::VARYING ? varying : ConstantValue();
+    } else if (first.kind == ConstantKind::VARYING || second.kind == ConstantKind::VARYING) {
+        return varying;
+    }
+
+    int result;
+
+    return evaluateOperation(instruction.opcode, instruction.isUnsigned, first.value, second.value, result) ? knownValue(result) : varying;
+}
+
+// Operand that an instruction reduces to when the other operand is an identity
+// element, or -1
+int identityOperand(Instruction& instruction, vector<ConstantValue>& values) {
+    if (instruction.operands.size() != 2) {
+        return -1;
+    }
+
+    auto isConstant = [&values](int value, int constant) {
+        return values.at(value).kind == ConstantKind::KNOWN && values.at(value).value == constant;
+    };
+
+    int first = instruction.operands.at(0);
+    int second = instruction.operands.at(1);
+
+    switch (instruction.opcode) {
+        case Opcode::ADD:
+            return isConstant(second, 0) ? first : isConstant(first, 0) ? second : -1;
+
+        case Opcode::MULTIPLY:
+            return isConstant(second, 1) ? first : isConstant(first, 1) ? second : -1;
+
+        case Opcode::SUBTRACT:
+        case Opcode::POINTER_ADD:
+        case Opcode::POINTER_SUBTRACT:
+            return isConstant(second, 0) ? first : -1;
+
+        case Opcode::DIVIDE:
+            return isConstant(second, 1) ? first : -1;
+
+        default:
+            return -1;
+    }
+}
+
+// Conditional constant propagation. Values flow only along edges that can be
+// taken, so a branch on a known condition keeps the other side unreachable.
+// Known results are then folded, identities become copies and decided branches
+// become jumps
+void propagateConstants(Procedure& procedure) {
+    int length = procedure.blocks.size();
+    int count = procedure.registers.size();
+    vector<vector<ConstantValue>> entries(length, vector<ConstantValue>(count));
+    vector<bool> executable(length, false);
+    vector<int> worklist = { 0 };
+
+    executable.at(0) = true;
+
+    while (!worklist.empty()) {
+        int current = worklist.back();
+        vector<ConstantValue> values = entries.at(current);
+        vector<int> targets;
+
+        worklist.pop_back();
+
+        for (Instruction& instruction : procedure.blocks.at(current).instructions) {
+            if (instruction.destination != -1) {
+                values.at(instruction.destination) = transferConstant(instruction, values);
+            }
+        }
+
+        Instruction& terminator = procedure.blocks.at(current).instructions.back();
+
+        if (terminator.opcode == Opcode::BRANCH) {
+            ConstantValue condition = values.at(terminator.operands.at(0));
+
+            if (condition.kind == ConstantKind::KNOWN) {
+                targets.push_back(condition.value != 0 ? terminator.target : terminator.alternative);
+            } else if (condition.kind == ConstantKind::VARYING) {
+                targets = successors(procedure.blocks.at(current));
+            }
+        } else {
+            targets = successors(procedure.blocks.at(current));
+        }
+
+        for (int target : targets) {
+            bool changed = !executable.at(target);
+
+            for (int i = 0; i < count; ++i) {
+                ConstantValue merged = meetValues(entries.at(target).at(i), values.at(i));
+
+                if (!(merged == entries.at(target).at(i))) {
+                    entries.at(target).at(i) = merged;
+                    changed = true;
+                }
+            }
+
+            if (changed) {
+                executable.at(target) = true;
+                worklist.push_back(target);
+            }
+        }
+    }
+
+    for (int i = 0; i < length; ++i) {
+        if (!executable.at(i)) {
+            continue;
+        }
+
+        vector<ConstantValue>& values = entries.at(i);
+
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            int destination = instruction.destination;
+
+            if (instruction.opcode == Opcode::BRANCH && values.at(instruction.operands.at(0)).kind == ConstantKind::KNOWN) {
+                instruction.target = values.at(instruction.operands.at(0)).value != 0 ? instruction.target : instruction.alternative;
+                instruction.alternative = -1;
+                instruction.opcode = Opcode::JUMP;
+                instruction.operands.clear();
+            }
+
+            if (destination == -1) {
+                continue;
+            }
+
+            ConstantValue result = transferConstant(instruction, values);
+            int identity = identityOperand(instruction, values);
+            bool isFoldable = instruction.opcode == Opcode::DIVIDE || instruction.opcode == Opcode::MODULO || !hasSideEffects(instruction);
+
+            if (isFoldable && result.kind == ConstantKind::KNOWN && instruction.opcode != Opcode::CONSTANT) {
+                instruction = createInstruction(Opcode::CONSTANT, destination, {}, result.value);
+            } else if (isFoldable && identity != -1) {
+                instruction = createInstruction(Opcode::COPY, destination, { identity });
+            }
+
+            values.at(destination) = result;
+        }
+
+        for (int j = 0; j < procedure.blocks.at(i).instructions.size(); ++j) {
+            Instruction& instruction = procedure.blocks.at(i).instructions.at(j);
+
+            if (instruction.opcode == Opcode::COPY && instruction.destination == instruction.operands.at(0)) {
+                procedure.blocks.at(i).instructions.erase(procedure.blocks.at(i).instructions.begin() + j--);
+            }
+        }
+    }
+
+    removeUnreachableBlocks(procedure);
+    removeUnusedValues(procedure);
+}
+
+const int MAXIMUM_MULTIPLY_CHAIN = 3;
+
+int removedMultiplications = 0;
+int removedDivisions = 0;
+
+bool isComparison(Opcode opcode) {
+    return opcode >= Opcode::LESS_THAN && opcode <= Opcode::NOT_EQUAL;
+}
+
+// Number of additions that multiply by a positive constant, doubling for each
+// bit below the highest and adding the operand once for every other set bit
+int multiplyChainLength(int constant) {
+    int length = -1;
+
+    for (int value = constant; value > 0; value >>= 1) {
+        length += 1 + (value & 1);
+    }
+
+    return length - 1;
+}
+
+// Values defined exactly once, by a constant
+unordered_map<int, int> constantRegisters(Procedure& procedure) {
+    vector<int> definitions(procedure.registers.size(), 0);
+    unordered_map<int, int> constants;
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.destination != -1) {
+                ++definitions.at(instruction.destination);
+
+                if (instruction.opcode == Opcode::CONSTANT) {
+                    constants[instruction.destination] = instruction.immediate;
+                }
+            }
+        }
+    }
+
+    for (auto it = constants.begin(); it != constants.end();) {
+        it = definitions.at(it->first) == 1 ? next(it) : constants.erase(it);
+    }
+
+    return constants;
+}
+
+// Memory a pointer may address, as the block of a new named by the register it
+// is assigned to, a frame slot by its offset, or memory outside the procedure.
+// Outside memory is whatever existed on entry and whatever escaped through
+// calls, returns and stores to outside memory
+typedef pair<Opcode, int> Location;
+
+const Location OUTSIDE_MEMORY = { Opcode::CALL, 0 };
+
+struct PointsTo {
+    bool isPrecise = false;
+    vector<set<Location>> targets;
+    set<Location> escaped;
+    unordered_set<int> addressed;
+    vector<pair<int, int>> addresses;
+};
+
+// Flow-insensitive points-to sets of every register, where a pointer loaded
+// from memory may address anything stored into the memory it was loaded from.
+// Outside code reads and writes everything that escaped, so everything that
+// escaped can hold any escaped pointer. Addresses are also split into a base
+// register and a constant offset in words, which keeps apart the words of one
+// block when both pointers come from the same base
+PointsTo analyzePointers(Procedure& procedure, unordered_map<int, int>& constants) {
+    PointsTo analysis;
+    map<Location, set<Location>> contents;
+    vector<int> definitionCounts(procedure.registers.size(), 0);
+    bool changed = true;
+
+    analysis.isPrecise = true;
+    analysis.targets.assign(procedure.registers.size(), set<Location>());
+    analysis.escaped = { OUTSIDE_MEMORY };
+    contents[OUTSIDE_MEMORY] = { OUTSIDE_MEMORY };
+
+    for (int offset : procedure.parameters) {
+        contents[{ Opcode::ADDRESS_LOCAL, offset }].insert(OUTSIDE_MEMORY);
+    }
+
+    auto merge = [&changed](set<Location>& into, set<Location> from) {
+        for (Location location : from) {
+            changed = into.insert(location).second || changed;
+        }
+    };
+
+    while (changed) {
+        changed = false;
+
+        for (BasicBlock& block : procedure.blocks) {
+            for (Instruction& instruction : block.instructions) {
+                int destination = instruction.destination;
+                vector<int>& operands = instruction.operands;
+
+                switch (instruction.opcode) {
+                    case Opcode::ADDRESS_LOCAL:
+                        merge(analysis.targets.at(destination), { { Opcode::ADDRESS_LOCAL, instruction.immediate } });
+                        analysis.addressed.insert(instruction.immediate);
+                        break;
+
+                    case Opcode::NEW:
+                        merge(analysis.targets.at(destination), { { Opcode::NEW, destination } });
+                        break;
+
+                    // Integers keep the targets of the pointers they were taken
+                    // from, so a pointer rebuilt from a difference of pointers may
+                    // address what either of them did
+                    case Opcode::COPY:
+                    case Opcode::ADD:
+                    case Opcode::SUBTRACT:
+                    case Opcode::MULTIPLY:
+                    case Opcode::DIVIDE:
+                    case Opcode::MODULO:
+                    case Opcode::POINTER_ADD:
+                    case Opcode::POINTER_SUBTRACT:
+                    case Opcode::POINTER_DIFFERENCE:
+                        for (int operand : operands) {
+                            merge(analysis.targets.at(destination), analysis.targets.at(operand));
+                        }
+
+                        break;
+
+                    case Opcode::LOAD:
+                        for (Location location : analysis.targets.at(operands.at(0))) {
+                            merge(analysis.targets.at(destination), contents[location]);
+                        }
+
+                        break;
+
+                    case Opcode::LOAD_LOCAL:
+                        merge(analysis.targets.at(destination), contents[{ Opcode::ADDRESS_LOCAL, instruction.immediate }]);
+                        break;
+
+                    case Opcode::STORE:
+                        for (Location location : analysis.targets.at(operands.at(0))) {
+                            merge(contents[location], analysis.targets.at(operands.at(1)));
+                        }
+
+                        break;
+
+                    case Opcode::STORE_LOCAL:
+                        merge(contents[{ Opcode::ADDRESS_LOCAL, instruction.immediate }], analysis.targets.at(operands.at(0)));
+                        break;
+
+                    case Opcode::CALL:
+                        for (int operand : operands) {
+                            merge(analysis.escaped, analysis.targets.at(operand));
+                        }
+
+                        merge(analysis.targets.at(destination), analysis.escaped);
+                        break;
+
+                    case Opcode::RETURN:
+                        for (int operand : operands) {
+                            merge(analysis.escaped, analysis.targets.at(operand));
+                        }
+
+                        break;
+
+                    default:
+                        break;
+                }
+            }
+        }
+
+        for (Location location : set<Location>(analysis.escaped)) {
+            merge(analysis.escaped, contents[location]);
+            merge(contents[location], analysis.escaped);
+        }
+    }
+
+    analysis.addresses.assign(procedure.registers.size(), { -1, 0 });
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.destination != -1) {
+                ++definitionCounts.at(instruction.destination);
+            }
+        }
+    }
+
+    // Definitions come before uses within a block and dominating blocks come
+    // first in the order of a tree walk, so one pass in block order misses only
+    // bases defined later in the layout, which then stay separate
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            Opcode opcode = instruction.opcode;
+
+            if ((opcode != Opcode::POINTER_ADD && opcode != Opcode::POINTER_SUBTRACT) || definitionCounts.at(instruction.destination) != 1
+                || constants.find(instruction.operands.at(1)) == constants.end() || definitionCounts.at(instruction.operands.at(0)) != 1) {
+                continue;
+            }
+
+            pair<int, int> base = analysis.addresses.at(instruction.operands.at(0));
+            int offset = constants[instruction.operands.at(1)] * (opcode == Opcode::POINTER_ADD ? 1 : -1);
+
+            analysis.addresses.at(instruction.destination) = base.first == -1 ? make_pair(instruction.operands.at(0), offset) 
+                : make_pair(base.first, base.second + offset);
+        }
+    }
+
+    return analysis;
+}
+
+// Whether a pointer may address a location, where a pointer the analysis
+// knows nothing about may address anything
+bool mayAddress(PointsTo& analysis, int pointer, Location location) {
+    if (!analysis.isPrecise) {
+        return true;
+    }
+
+    set<Location>& targets = analysis.targets.at(pointer);
+
+    return targets.empty() || targets.find(location) != targets.end();
+}
+
+bool mayAlias(PointsTo& analysis, int first, int second) {
+    if (!analysis.isPrecise) {
+        return true;
+    }
+
+    pair<int, int> firstAddress = analysis.addresses.at(first).first == -1 ? make_pair(first, 0) : analysis.addresses.at(first);
+    pair<int, int> secondAddress = analysis.addresses.at(second).first == -1 ? make_pair(second, 0) : analysis.addresses.at(second);
+
+    if (firstAddress.first == secondAddress.first) {
+        return firstAddress.second == secondAddress.second;
+    }
+
+    for (Location location : analysis.targets.at(first)) {
+        if (mayAddress(analysis, second, location)) {
+            return true;
+        }
+    }
+
+    return analysis.targets.at(first).empty();
+}
+
+// Whether outside code, reached through a call, may write what a pointer addresses
+bool mayEscape(PointsTo& analysis, int pointer) {
+    if (!analysis.isPrecise) {
+        return true;
+    }
+
+    for (Location location : analysis.escaped) {
+        if (mayAddress(analysis, pointer, location)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// What an instruction computes, as its opcode, signedness, operands and
+// immediate, with the operands of commutative operations in order. Constant
+// operands stand for their value rather than their register
+typedef tuple<Opcode, bool, vector<long long>, int> Expression;
+
+const long long CONSTANT_OPERAND = 1LL << 32;
+
+struct AvailableValue {
+    int value;
+    int block;
+    bool isStored;
+};
+
+// Comparisons are left alone, since a branch testing a reused result cannot be
+// fused with the comparison
+bool isNumbered(Instruction& instruction) {
+    switch (instruction.opcode) {
+        case Opcode::ADD:
+        case Opcode::SUBTRACT:
+        case Opcode::MULTIPLY:
+        case Opcode::DIVIDE:
+        case Opcode::MODULO:
+        case Opcode::POINTER_ADD:
+        case Opcode::POINTER_SUBTRACT:
+        case Opcode::POINTER_DIFFERENCE:
+        case Opcode::LOAD_LOCAL:
+        case Opcode::LOAD:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+Expression expressionOf(Instruction& instruction, unordered_map<int, int>& constants) {
+    vector<long long> operands;
+    Opcode opcode = instruction.opcode;
+
+    for (int operand : instruction.operands) {
+        bool isConstant = constants.find(operand) != constants.end() && opcode != Opcode::LOAD;
+
+        operands.push_back(isConstant ? CONSTANT_OPERAND + constants[operand] : operand);
+    }
+
+    if (opcode == Opcode::ADD || opcode == Opcode::MULTIPLY || opcode == Opcode::EQUAL || opcode == Opcode::NOT_EQUAL) {
+        sort(operands.begin(), operands.end());
+    }
+
+    return Expression(opcode, instruction.isUnsigned, operands, instruction.immediate);
+}
+
+// Forgets the values an instruction may change. Redefining a register changes
+// every expression reading it, and writes to memory change the loads that may
+// read the same word. Frame slots whose address is never taken only change
+// through stores to their offset
+void invalidateValues(map<Expression, AvailableValue>& values, Instruction& instruction, PointsTo& analysis) {
+    Opcode opcode = instruction.opcode;
+
+    for (auto it = values.begin(); it != values.end();) {
+        Opcode kind = get<0>(it->first);
+        const vector<long long>& operands = get<2>(it->first);
+        int offset = get<3>(it->first);
+        bool isAddressed = analysis.addressed.find(offset) != analysis.addressed.end();
+        bool isChanged = find(operands.begin(), operands.end(), instruction.destination) != operands.end();
+
+        if (kind == Opcode::LOAD) {
+            int address = operands.at(0);
+            Location slot = { Opcode::ADDRESS_LOCAL, instruction.immediate };
+
+            isChanged = isChanged || ((opcode == Opcode::STORE || opcode == Opcode::DELETE) && mayAlias(analysis, address, instruction.operands.at(0)))
+                || (opcode == Opcode::STORE_LOCAL && analysis.addressed.find(slot.second) != analysis.addressed.end() && mayAddress(analysis, address, slot))
+                || (opcode == Opcode::CALL && mayEscape(analysis, address));
+        } else if (kind == Opcode::LOAD_LOCAL) {
+            Location slot = { Opcode::ADDRESS_LOCAL, offset };
+
+            isChanged = isChanged || (opcode == Opcode::STORE_LOCAL && instruction.immediate == offset)
+                || ((opcode == Opcode::STORE || opcode == Opcode::DELETE) && isAddressed && mayAddress(analysis, instruction.operands.at(0), slot))
+                || (opcode == Opcode::CALL && isAddressed && (!analysis.isPrecise || analysis.escaped.find(slot) != analysis.escaped.end()));
+        }
+
+        it = isChanged ? values.erase(it) : next(it);
+    }
+}
+
+// Value numbering over the dominator tree. Each block starts from the values
+// available at the end of its immediate dominator, less those that anything
+// on a path between the two may change, and reuses an earlier computation of
+// the same expression instead of repeating it. Only values that are never
+// redefined are reused, so a reuse either replaces the result everywhere or
+// becomes a copy into a variable. With alias analysis, a store also makes the
+// stored value available to loads of the same address
+int eliminateCommonSubexpressions(Procedure& procedure, int& global, int& forwarded, int& loads) {
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    vector<int> dominators = computeDominators(procedure);
+    unordered_map<int, int> constants = constantRegisters(procedure);
+    int length = procedure.blocks.size();
+    vector<int> definitionCounts(procedure.registers.size(), 0);
+    vector<int> replacements(procedure.registers.size(), -1);
+    vector<vector<int>> children(length);
+    PointsTo analysis;
+    int count = 0;
+
+    global = 0;
+    forwarded = 0;
+    loads = 0;
+
+    if (options.aliasAnalysis) {
+        analysis = analyzePointers(procedure, constants);
+    }
+
+    for (int i = 0; i < length; ++i) {
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            if (instruction.destination != -1) {
+                ++definitionCounts.at(instruction.destination);
+            }
+
+            if (instruction.opcode == Opcode::ADDRESS_LOCAL) {
+                analysis.addressed.insert(instruction.immediate);
+            }
+        }
+
+        if (i > 0 && dominators.at(i) != -1) {
+            children.at(dominators.at(i)).push_back(i);
+        }
+    }
+
+    auto reachable = [&](int start, int avoided, vector<vector<int>>& edges) {
+        vector<bool> isReached(length, false);
+        vector<int> worklist;
+
+        for (int next : edges.at(start)) {
+            if (next != avoided && !isReached.at(next)) {
+                isReached.at(next) = true;
+                worklist.push_back(next);
+            }
+        }
+
+        while (!worklist.empty()) {
+            int current = worklist.back();
+            worklist.pop_back();
+
+            for (int next : edges.at(current)) {
+                if (next != avoided && !isReached.at(next)) {
+                    isReached.at(next) = true;
+                    worklist.push_back(next);
+                }
+            }
+        }
+
+        return isReached;
+    };
+
+    vector<pair<int, map<Expression, AvailableValue>>> stack = { { 0, {} } };
+
+    while (!stack.empty()) {
+        int current = stack.back().first;
+        map<Expression, AvailableValue> values = stack.back().second;
+        vector<Instruction>& instructions = procedure.blocks.at(current).instructions;
+
+        stack.pop_back();
+
+        // Blocks between the dominator and this one, which includes this one
+        // when it can come around to itself
+        if (current > 0) {
+            vector<bool> isAfter = reachable(dominators.at(current), dominators.at(current), graph.successors);
+            vector<bool> isBefore = reachable(current, dominators.at(current), graph.predecessors);
+
+            for (int i = 0; i < length; ++i) {
+                for (int j = 0; isAfter.at(i) && isBefore.at(i) && j < procedure.blocks.at(i).instructions.size(); ++j) {
+                    invalidateValues(values, procedure.blocks.at(i).instructions.at(j), analysis);
+                }
+            }
+        }
+
+        for (int i = 0; i < instructions.size(); ++i) {
+            Instruction& instruction = instructions.at(i);
+
+            for (int& operand : instruction.operands) {
+                operand = replacements.at(operand) == -1 ? operand : replacements.at(operand);
+            }
+
+            if (!isNumbered(instruction)) {
+                invalidateValues(values, instruction, analysis);
+
+                int value = instruction.operands.empty() ? -1 : instruction.operands.back();
+
+                if (options.aliasAnalysis && (instruction.opcode == Opcode::STORE || instruction.opcode == Opcode::STORE_LOCAL) 
+                    && definitionCounts.at(value) == 1) {
+                    Instruction load = instruction;
+
+                    load.opcode = instruction.opcode == Opcode::STORE ? Opcode::LOAD : Opcode::LOAD_LOCAL;
+                    load.operands.pop_back();
+                    values[expressionOf(load, constants)] = { value, current, true };
+                }
+
+                continue;
+            }
+
+            // A copy into a variable costs as much as one addition and keeps
+            // the earlier value alive for longer
+            Expression expression = expressionOf(instruction, constants);
+            auto available = values.find(expression);
+            int destination = instruction.destination;
+            Opcode opcode = instruction.opcode;
+
+            bool isCheap = opcode == Opcode::ADD || opcode == Opcode::SUBTRACT || ((opcode == Opcode::POINTER_ADD || opcode == Opcode::POINTER_SUBTRACT) 
+                && constants.find(instruction.operands.at(1)) != constants.end());
+
+            if (definitionCounts.at(destination) != 1 && isCheap) {
+                available = values.end();
+            }
+
+            if (available != values.end()) {
+                bool isLoad = instruction.opcode == Opcode::LOAD || instruction.opcode == Opcode::LOAD_LOCAL;
+
+                ++count;
+                global += available->second.block != current;
+                forwarded += isLoad && available->second.isStored;
+                loads += isLoad && !available->second.isStored;
+
+                if (definitionCounts.at(destination) == 1) {
+                    replacements.at(destination) = available->second.value;
+                    instructions.erase(instructions.begin() + i--);
+                    continue;
+                }
+
+                instruction = createInstruction(Opcode::COPY, destination, { available->second.value });
+            }
+
+            invalidateValues(values, instruction, analysis);
+
+            if (available == values.end() && definitionCounts.at(destination) == 1) {
+                values[expression] = { destination, current, false };
+            }
+        }
+
+        for (int child : children.at(current)) {
+            stack.push_back({ child, values });
+        }
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            for (int& operand : instruction.operands) {
+                operand = replacements.at(operand) == -1 ? operand : replacements.at(operand);
+            }
+        }
+    }
+
+    removeUnusedValues(procedure);
+
+    return count;
+}
+
+void eliminateCommonSubexpressions(Procedure& procedure) {
+    int global;
+    int forwarded;
+    int loads;
+    int count = eliminateCommonSubexpressions(procedure, global, forwarded, loads);
+
+    if (options.report) {
+        cerr << "common subexpressions: " << count << " expressions eliminated in " << procedure.name << ", " << global 
+            << " across blocks" << endl;
+    }
+
+    if (options.report && options.aliasAnalysis) {
+        cerr << "alias analysis: " << forwarded << " loads forwarded from stores and " << loads << " redundant loads removed in " 
+            << procedure.name << endl;
+    }
+}
+
+// The definition every value of a pointer at an instruction was stepped from
+// by copies and pointer arithmetic, or -2 when there may be several. A base
+// outside every loop runs at most once, so pointers from it lie a whole
+// number of words apart
+int pointerBase(Procedure& procedure, ReachingDefinitions& reaching, vector<int>& bases, int block, int index, int value) {
+    int base = -1;
+
+    for (int number : reachingDefinitions(procedure, reaching, block, index, value)) {
+        base = base == -1 || base == bases.at(number) ? bases.at(number) : -2;
+    }
+
+    return base == -1 ? -2 : base;
+}
+
+// Pointer differences between two pointers stepped from the same base, whose
+// every use is a comparison against a constant or another such difference, or
+// the index of pointer arithmetic. These can stay in bytes and skip the
+// division by four. NULL or a pointer from elsewhere need not be a whole
+// number of words away, and its byte difference would compare and index
+// differently
+unordered_set<int> byteDifferences(Procedure& procedure, unordered_map<int, int>& constants) {
+    ReachingDefinitions reaching = computeReachingDefinitions(procedure);
+    vector<int> definitions(procedure.registers.size(), 0);
+    vector<int> bases(reaching.positions.size(), -1);
+    unordered_set<int> loopBlocks;
+    unordered_set<int> differences;
+    bool changed = true;
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.destination != -1) {
+                ++definitions.at(instruction.destination);
+            }
+        }
+    }
+
+    for (Loop& loop : findLoops(procedure)) {
+        loopBlocks.insert(loop.blocks.begin(), loop.blocks.end());
+    }
+
+    while (changed) {
+        changed = false;
+
+        for (int number = 0; number < reaching.positions.size(); ++number) {
+            pair<int, int> position = reaching.positions.at(number);
+            Instruction& instruction = procedure.blocks.at(position.first).instructions.at(position.second);
+            int base = loopBlocks.find(position.first) == loopBlocks.end() ? number : -2;
+
+            if (bases.at(number) == -2) {
+                continue;
+            } else if (instruction.opcode == Opcode::COPY || instruction.opcode == Opcode::POINTER_ADD || instruction.opcode == Opcode::POINTER_SUBTRACT) {
+                base = -1;
+
+                for (int source : reachingDefinitions(procedure, reaching, position.first, position.second, instruction.operands.at(0))) {
+                    base = bases.at(source) == -1 ? base : base == -1 || base == bases.at(source) ? bases.at(source) : -2;
+                }
+            }
+
+            if (base != -1 && base != bases.at(number)) {
+                bases.at(number) = bases.at(number) == -1 ? base : -2;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (int j = 0; j < procedure.blocks.at(i).instructions.size(); ++j) {
+            Instruction& instruction = procedure.blocks.at(i).instructions.at(j);
+
+            if (instruction.opcode != Opcode::POINTER_DIFFERENCE) {
+                continue;
+            }
+
+            int base = pointerBase(procedure, reaching, bases, i, j, instruction.operands.at(0));
+
+            if (base >= 0 && base == pointerBase(procedure, reaching, bases, i, j, instruction.operands.at(1))) {
+                differences.insert(instruction.destination);
+            }
+        }
+    }
+
+    changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (BasicBlock& block : procedure.blocks) {
+            for (Instruction& instruction : block.instructions) {
+                for (int i = 0; i < instruction.operands.size(); ++i) {
+                    int operand = instruction.operands.at(i);
+
+                    if (differences.find(operand) == differences.end()) {
+                        continue;
+                    }
+
+                    bool allowed = definitions.at(operand) == 1;
+
+                    if (isComparison(instruction.opcode)) {
+                        int other = instruction.operands.at(1 - i);
+                        auto constant = constants.find(other);
+
+                        allowed = allowed && (differences.find(other) != differences.end() 
+                            || (constant != constants.end() && abs(constant->second) < (1 << 29)));
+                    } else {
+                        allowed = allowed && (instruction.opcode == Opcode::POINTER_ADD || instruction.opcode == Opcode::POINTER_SUBTRACT) && i == 1;
+                    }
+
+                    if (!allowed) {
+                        differences.erase(operand);
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    return differences;
+}
+
+// Replaces multiplications and divisions by cheaper additions. Multiplying by
+// a small constant becomes a chain of additions, pointer arithmetic with a
+// constant index is scaled at compile time, and pointer differences that are
+// only compared or added back to pointers are left in bytes
+void reduceStrength(Procedure& procedure) {
+    unordered_map<int, int> constants = constantRegisters(procedure);
+    unordered_set<int> differences = byteDifferences(procedure, constants);
+
+    for (BasicBlock& block : procedure.blocks) {
+        vector<Instruction> instructions;
+
+        for (Instruction& instruction : block.instructions) {
+            Opcode opcode = instruction.opcode;
+            auto constantOperand = [&](int index) {
+                auto constant = constants.find(instruction.operands.at(index));
+
+                return constant == constants.end() ? 0 : constant->second;
+            };
+            auto appendInstruction = [&](Opcode opcode, Type type, vector<int> operands, int immediate) {
+                instructions.push_back(createInstruction(opcode, newRegister(procedure, type), operands, immediate));
+
+                return instructions.back().destination;
+            };
+
+            if (opcode == Opcode::POINTER_DIFFERENCE && differences.find(instruction.destination) != differences.end()) {
+                instruction.opcode = Opcode::SUBTRACT;
+                ++removedDivisions;
+            } else if ((opcode == Opcode::POINTER_ADD || opcode == Opcode::POINTER_SUBTRACT) && differences.find(instruction.operands.at(1)) != differences.end()) {
+                instruction.opcode = opcode == Opcode::POINTER_ADD ? Opcode::ADD : Opcode::SUBTRACT;
+            } else if ((opcode == Opcode::POINTER_ADD || opcode == Opcode::POINTER_SUBTRACT) && constants.find(instruction.operands.at(1)) != constants.end()) {
+                instruction.operands.at(1) = appendInstruction(Opcode::CONSTANT, Type::INT, {}, constantOperand(1) * 4);
+                instruction.opcode = opcode == Opcode::POINTER_ADD ? Opcode::ADD : Opcode::SUBTRACT;
+                ++removedMultiplications;
+            } else if (isComparison(opcode)) {
+                for (int i = 0; i < 2; ++i) {
+                    int other = instruction.operands.at(1 - i);
+
+                    if (differences.find(instruction.operands.at(i)) != differences.end() && differences.find(other) == differences.end()) {
+                        instruction.operands.at(1 - i) = appendInstruction(Opcode::CONSTANT, Type::INT, {}, constantOperand(1 - i) * 4);
+                    }
+                }
+            } else if (opcode == Opcode::MULTIPLY) {
+                int index = constantOperand(1) > 1 ? 1 : 0;
+                int constant = constantOperand(index);
+                int operand = instruction.operands.at(1 - index);
+
+                if (constant > 1 && multiplyChainLength(constant) <= MAXIMUM_MULTIPLY_CHAIN) {
+                    int highest = 31 - __builtin_clz(constant);
+                    int value = operand;
+
+                    for (int bit = highest - 1; bit >= 0; --bit) {
+                        value = appendInstruction(Opcode::ADD, Type::INT, { value, value }, 0);
+
+                        if (constant >> bit & 1) {
+                            value = appendInstruction(Opcode::ADD, Type::INT, { value, operand }, 0);
+                        }
+                    }
+
+                    instructions.back().destination = instruction.destination;
+                    ++removedMultiplications;
+                    continue;
+                }
+            }
+
+            instructions.push_back(instruction);
+        }
+
+        block.instructions = instructions;
+    }
+
+    removeUnusedValues(procedure);
+}
+
+// Sends jumps into blocks that only jump elsewhere straight to the final
+// target, and turns branches whose targets agree into jumps
+void threadJumps(Procedure& procedure) {
+    auto finalTarget = [&procedure](int block) {
+        for (int steps = 0; steps < procedure.blocks.size(); ++steps) {
+            vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+
+            if (block == 0 || instructions.size() != 1 || instructions.back().opcode != Opcode::JUMP) {
+                break;
+            }
+
+            block = instructions.back().target;
+        }
+
+        return block;
+    };
+
+    for (BasicBlock& block : procedure.blocks) {
+        Instruction& terminator = block.instructions.back();
+
+        if (terminator.opcode == Opcode::JUMP || terminator.opcode == Opcode::BRANCH) {
+            terminator.target = finalTarget(terminator.target);
+        }
+
+        if (terminator.opcode == Opcode::BRANCH) {
+            terminator.alternative = finalTarget(terminator.alternative);
+
+            if (terminator.target == terminator.alternative) {
+                terminator.opcode = Opcode::JUMP;
+                terminator.operands.clear();
+                terminator.alternative = -1;
+            }
+        }
+    }
+}
+
+// Appends a block to the one jumping into it when that jump is its only way
+// in, then drops the blocks that can no longer be reached
+void simplifyControlFlow(Procedure& procedure) {
+    threadJumps(procedure);
+    removeUnreachableBlocks(procedure);
+
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        vector<Instruction>& instructions = procedure.blocks.at(i).instructions;
+        int target = instructions.back().target;
+
+        while (instructions.back().opcode == Opcode::JUMP && target != 0 && target != i && graph.predecessors.at(target).size() == 1) {
+            vector<Instruction>& merged = procedure.blocks.at(target).instructions;
+
+            instructions.pop_back();
+            instructions.insert(instructions.end(), merged.begin(), merged.end());
+            graph.predecessors.at(target).clear();
+
+            for (int successor : successors(procedure.blocks.at(i))) {
+                replace(graph.predecessors.at(successor).begin(), graph.predecessors.at(successor).end(), target, i);
+            }
+
+            merged = { createInstruction(Opcode::JUMP, -1, {}) };
+            merged.back().target = target;
+            target = instructions.back().target;
+        }
+    }
+
+    removeUnreachableBlocks(procedure);
+}
+
+// Marks every instruction with a side effect, then every definition that
+// reaches an operand of a marked instruction, and removes the rest. This
+// drops stores to variables that are never read and initializers that are
+// overwritten before use, along with anything that only feeds them
+bool sweepDeadCode(Procedure& procedure) {
+    simplifyControlFlow(procedure);
+
+    ReachingDefinitions reaching = computeReachingDefinitions(procedure);
+    vector<vector<bool>> marked(procedure.blocks.size());
+    vector<pair<int, int>> worklist;
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (int j = 0; j < procedure.blocks.at(i).instructions.size(); ++j) {
+            marked.at(i).push_back(hasSideEffects(procedure.blocks.at(i).instructions.at(j)));
+
+            if (marked.at(i).back()) {
+                worklist.push_back({ i, j });
+            }
+        }
+    }
+
+    while (!worklist.empty()) {
+        pair<int, int> current = worklist.back();
+        worklist.pop_back();
+
+        for (int operand : procedure.blocks.at(current.first).instructions.at(current.second).operands) {
+            for (int number : reachingDefinitions(procedure, reaching, current.first, current.second, operand)) {
+                pair<int, int> position = reaching.positions.at(number);
+
+                if (!marked.at(position.first).at(position.second)) {
+                    marked.at(position.first).at(position.second) = true;
+                    worklist.push_back(position);
+                }
+            }
+        }
+    }
+
+    bool changed = false;
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        vector<Instruction> instructions;
+
+        for (int j = 0; j < procedure.blocks.at(i).instructions.size(); ++j) {
+            if (marked.at(i).at(j)) {
+                instructions.push_back(procedure.blocks.at(i).instructions.at(j));
+            }
+        }
+
+        changed = changed || instructions.size() != procedure.blocks.at(i).instructions.size();
+        procedure.blocks.at(i).instructions = instructions;
+    }
+
+    return changed;
+}
+
+// Removing code can empty blocks, so sweeping repeats with the control flow
+// cleanup until nothing changes
+void eliminateDeadCode(Procedure& procedure) {
+    bool changed = true;
+
+    while (changed) {
+        changed = sweepDeadCode(procedure);
+    }
+}
+
+int procedureSize(Procedure& procedure) {
+    int size = 0;
+
+    for (BasicBlock& block : procedure.blocks) {
+        size += block.instructions.size();
+    }
+
+    return size;
+}
+
+bool isRecursive(Procedure& procedure) {
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.opcode == Opcode::CALL && instruction.symbol == procedure.name) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Parameters whose slots are read but never written or addressed, so a
+// constant argument can stand in for every read
+vector<bool> readOnlyParameters(Procedure& procedure) {
+    unordered_set<int> written;
+    vector<bool> readOnly;
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.opcode == Opcode::STORE_LOCAL || instruction.opcode == Opcode::ADDRESS_LOCAL) {
+                written.insert(instruction.immediate);
+            }
+        }
+    }
+
+    for (int offset : procedure.parameters) {
+        readOnly.push_back(written.find(offset) == written.end());
+    }
+
+    return readOnly;
+}
+
+// Whether the parameter feeds a comparison or a multiplication, division or
+// modulo, which a constant lets the procedure decide or reduce
+bool isSpecializable(Procedure& procedure, int offset) {
+    unordered_set<int> reads;
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.opcode == Opcode::LOAD_LOCAL && instruction.immediate == offset) {
+                reads.insert(instruction.destination);
+            }
+        }
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (!isComparison(instruction.opcode) && instruction.opcode != Opcode::MULTIPLY && instruction.opcode != Opcode::DIVIDE
+                && instruction.opcode != Opcode::MODULO) {
+                continue;
+            }
+
+            for (int operand : instruction.operands) {
+                if (reads.find(operand) != reads.end()) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+// Assigns the constant to the parameter on entry, the way a declaration
+// initializes a local
+void bindParameter(Procedure& procedure, int index, int value) {
+    vector<Instruction>& entry = procedure.blocks.at(0).instructions;
+    int constant = newRegister(procedure, procedure.parameterTypes.at(index));
+
+    entry.insert(entry.begin(), {
+        createInstruction(Opcode::CONSTANT, constant, {}, value),
+        createInstruction(Opcode::STORE_LOCAL, -1, { constant }, procedure.parameters.at(index))
+    });
+}
+
+// Values the arguments of a call pass to the callee. A recursive call that
+// passes a parameter on in its own position adds nothing, so it stays unknown
+vector<ConstantValue> argumentValues(Procedure& caller, Instruction& call) {
+    unordered_map<int, int> constants = constantRegisters(caller);
+    unordered_map<int, int> passed;
+    vector<ConstantValue> values;
+
+    if (call.symbol == caller.name) {
+        vector<bool> readOnly = readOnlyParameters(caller);
+
+        for (BasicBlock& block : caller.blocks) {
+            for (Instruction& instruction : block.instructions) {
+                for (int i = 0; i < caller.parameters.size(); ++i) {
+                    if (instruction.opcode == Opcode::LOAD_LOCAL && instruction.immediate == caller.parameters.at(i) && readOnly.at(i)) {
+                        passed[instruction.destination] = passed.find(instruction.destination) == passed.end() ? i : -1;
+                    }
+                }
+            }
+        }
+
+        for (auto& constant : constants) {
+            passed.erase(constant.first);
+        }
+    }
+
+    for (int i = 0; i < call.operands.size(); ++i) {
+        int operand = call.operands.at(i);
+
+        if (constants.find(operand) != constants.end()) {
+            values.push_back(knownValue(constants[operand]));
+        } else if (passed.find(operand) != passed.end() && passed[operand] == i) {
+            values.push_back(ConstantValue());
+        } else {
+            values.push_back(ConstantValue());
+            values.back().kind = ConstantKind::VARYING;
+        }
+    }
+
+    return values;
+}
+
+// Interprocedural constant propagation. Parameters that every call passes the
+// same constant are bound in the procedure itself. Calls that pass constants
+// to parameters the procedure branches on or multiplies by are redirected to
+// a clone bound to those constants, one clone per combination, while the
+// cloned code fits the growth budget. Procedures may only call earlier ones,
+// so each clone goes right after its original and every call to a procedure
+// is found in it or a later one
+void specializeProcedures(vector<Procedure>& procedures) {
+    int budget = options.specializeGrowth;
+    int clones = 0;
+
+    for (int i = 0; i < procedures.size(); ++i) {
+        Procedure& callee = procedures.at(i);
+
+        // Procedures the inliner takes anyway see the constants at each call
+        if (callee.isMain || (options.inlining && options.registerExpressions && !isRecursive(callee) && procedureSize(callee) <= options.inlineSize)) {
+            continue;
+        }
+
+        vector<pair<Instruction*, vector<ConstantValue>>> calls;
+        vector<ConstantValue> common(callee.parameters.size());
+        vector<bool> readOnly = readOnlyParameters(callee);
+
+        for (int j = i; j < procedures.size(); ++j) {
+            for (BasicBlock& block : procedures.at(j).blocks) {
+                for (Instruction& instruction : block.instructions) {
+                    if (instruction.opcode != Opcode::CALL || instruction.symbol != callee.name) {
+                        continue;
+                    }
+
+                    vector<ConstantValue> values = argumentValues(procedures.at(j), instruction);
+
+                    for (int k = 0; k < common.size(); ++k) {
+                        common.at(k) = meetValues(common.at(k), values.at(k));
+                    }
+
+                    // Recursive calls of the original stay, or recursion
+                    // would become mutual, and calls that never ran keep it
+                    if (j != i && block.count != 0) {
+                        calls.push_back({ &instruction, values });
+                    }
+                }
+            }
+        }
+
+        for (int k = 0; k < common.size(); ++k) {
+            if (readOnly.at(k) && common.at(k).kind == ConstantKind::KNOWN) {
+                bindParameter(callee, k, common.at(k).value);
+
+                if (options.report) {
+                    cerr << "specialization: parameter " << k + 1 << " of " << callee.name << " is " << common.at(k).value << " at every call" << endl;
+                }
+            }
+        }
+
+        map<vector<pair<int, int>>, vector<Instruction*>> groups;
+
+        for (auto& call : calls) {
+            vector<pair<int, int>> bindings;
+
+            for (int k = 0; k < common.size(); ++k) {
+                if (readOnly.at(k) && common.at(k).kind == ConstantKind::VARYING && call.second.at(k).kind == ConstantKind::KNOWN
+                    && isSpecializable(callee, callee.parameters.at(k))) {
+                    bindings.push_back({ k, call.second.at(k).value });
+                }
+            }
+
+            if (!bindings.empty()) {
+                groups[bindings].push_back(call.first);
+            }
+        }
+
+        vector<Procedure> specialized;
+
+        for (auto& group : groups) {
+            int size = procedureSize(callee);
+
+            if (size > budget) {
+                continue;
+            }
+
+            Procedure clone = callee;
+            string name = to_string(++clones) + callee.name;
+            budget -= size;
+
+            for (BasicBlock& block : clone.blocks) {
+                block.label = generateLabel();
+            }
+
+            // Recursive calls that keep passing the same constants stay in
+            // the clone
+            for (BasicBlock& block : clone.blocks) {
+                for (Instruction& instruction : block.instructions) {
+                    if (instruction.opcode != Opcode::CALL || instruction.symbol != callee.name) {
+                        continue;
+                    }
+
+                    vector<ConstantValue> values = argumentValues(clone, instruction);
+                    bool isSame = true;
+
+                    for (pair<int, int> binding : group.first) {
+                        ConstantValue passed = values.at(binding.first);
+                        isSame = isSame && (passed.kind == ConstantKind::UNKNOWN || passed == knownValue(binding.second));
+                    }
+
+                    instruction.symbol = isSame ? name : instruction.symbol;
+                }
+            }
+
+            clone.name = name;
+
+            for (pair<int, int> binding : group.first) {
+                bindParameter(clone, binding.first, binding.second);
+            }
+
+            for (Instruction* call : group.second) {
+                call->symbol = clone.name;
+            }
+
+            if (options.report) {
+                cerr << "specialization: " << callee.name << " cloned as " << generateFunction(clone.name) << " for";
+
+                for (int k = 0; k < group.first.size(); ++k) {
+                    cerr << (k == 0 ? " parameter " : ", parameter ") << group.first.at(k).first + 1 << " = " << group.first.at(k).second;
+                }
+
+                cerr << " at " << group.second.size() << " calls" << endl;
+            }
+
+            specialized.push_back(clone);
+        }
+
+        procedures.insert(procedures.begin() + i + 1, specialized.begin(), specialized.end());
+        i += specialized.size();
+    }
+}
+
+// Replaces a call with a copy of the body of the callee. The callee's virtual
+// registers and frame slots get fresh ones in the caller, parameters that are
+// only read take the arguments directly and the rest are stored into slots.
+// The instructions after the call move to a new block that the copied return
+// jumps to
+void inlineCall(Procedure& caller, int block, int index, Procedure& callee) {
+    vector<Instruction>& instructions = caller.blocks.at(block).instructions;
+    Instruction call = instructions.at(index);
+    vector<Instruction> rest(instructions.begin() + index + 1, instructions.end());
+    vector<int> registers;
+    unordered_map<int, int> slots;
+    unordered_set<int> written;
+    unordered_map<int, int> arguments;
+
+    instructions.erase(instructions.begin() + index, instructions.end());
+
+    auto slotAt = [&caller, &slots](int offset) {
+        if (slots.find(offset) == slots.end()) {
+            slots[offset] = -caller.frameSize;
+            caller.frameSize += 4;
+        }
+
+        return slots[offset];
+    };
+
+    for (Type type : callee.registers) {
+        registers.push_back(newRegister(caller, type));
+    }
+
+    long long site = caller.blocks.at(block).count;
+    long long entries = callee.blocks.at(0).count;
+
+    for (BasicBlock& calleeBlock : callee.blocks) {
+        for (Instruction& instruction : calleeBlock.instructions) {
+            if (instruction.opcode == Opcode::STORE_LOCAL || instruction.opcode == Opcode::ADDRESS_LOCAL) {
+                written.insert(instruction.immediate);
+            }
+        }
+    }
+
+    for (int i = 0; i < callee.parameters.size(); ++i) {
+        if (written.find(callee.parameters.at(i)) == written.end()) {
+            arguments[callee.parameters.at(i)] = call.operands.at(i);
+        } else {
+            appendEffect(caller, block, Opcode::STORE_LOCAL, { call.operands.at(i) }, slotAt(callee.parameters.at(i)));
+        }
+    }
+
+    int first = caller.blocks.size();
+
+    for (int i = 0; i < callee.blocks.size(); ++i) {
+        newBlock(caller);
+    }
+
+    int after = newBlock(caller);
+
+    caller.blocks.at(after).instructions = rest;
+    caller.blocks.at(after).count = site;
+    appendJump(caller, block, first);
+
+    // The callee's profile counts cover all of its calls, so the copy takes
+    // the share of this one
+    for (int i = 0; i < callee.blocks.size(); ++i) {
+        long long count = callee.blocks.at(i).count;
+
+        caller.blocks.at(first + i).count = site >= 0 && entries > 0 && count >= 0 ? count * site / entries : -1;
+    }
+
+    for (int i = 0; i < callee.blocks.size(); ++i) {
+        for (Instruction instruction : callee.blocks.at(i).instructions) {
+            for (int& operand : instruction.operands) {
+                operand = registers.at(operand);
+            }
+
+            if (instruction.destination != -1) {
+                instruction.destination = registers.at(instruction.destination);
+            }
+
+            if (instruction.opcode == Opcode::LOAD_LOCAL && arguments.find(instruction.immediate) != arguments.end()) {
+                instruction = createInstruction(Opcode::COPY, instruction.destination, { arguments[instruction.immediate] });
+            } else if (instruction.opcode == Opcode::LOAD_LOCAL || instruction.opcode == Opcode::STORE_LOCAL || instruction.opcode == Opcode::ADDRESS_LOCAL) {
+                instruction.immediate = slotAt(instruction.immediate);
+            }
+
+            if (instruction.opcode == Opcode::RETURN) {
+                appendValue(caller, first + i, Opcode::COPY, Type::INT, instruction.operands);
+                caller.blocks.at(first + i).instructions.back().destination = call.destination;
+                appendJump(caller, first + i, after);
+                continue;
+            }
+
+            if (instruction.target != -1) {
+                instruction.target += first;
+            }
+
+            if (instruction.alternative != -1) {
+                instruction.alternative += first;
+            }
+
+            caller.blocks.at(first + i).instructions.push_back(instruction);
+        }
+    }
+
+    for (auto& variable : callee.variableSlots) {
+        caller.variableSlots[registers.at(variable.first)] = slotAt(variable.second);
+    }
+}
+
+// Blocks that ran at least a hundredth as often as the hottest one
+bool isHot(BasicBlock& block) {
+    return block.count > 0 && block.count * 100 >= profileMaximum;
+}
+
+// Inlines calls to small procedures that do not call themselves. Procedures
+// may only call earlier ones, so every callee has already been optimized. With
+// a profile, calls that never ran stay calls and hot ones may inline callees
+// twice the usual size
+void inlineCalls(vector<Procedure>& procedures, int index) {
+    Procedure& caller = procedures.at(index);
+    unordered_map<string, int> indices;
+    int count = 0;
+
+    for (int i = 0; i < index; ++i) {
+        indices[procedures.at(i).name] = i;
+    }
+
+    for (int i = 0; i < caller.blocks.size(); ++i) {
+        for (int j = 0; j < caller.blocks.at(i).instructions.size(); ++j) {
+            Instruction& instruction = caller.blocks.at(i).instructions.at(j);
+
+            if (instruction.opcode != Opcode::CALL || indices.find(instruction.symbol) == indices.end()) {
+                continue;
+            }
+
+            Procedure& callee = procedures.at(indices[instruction.symbol]);
+            int size = procedureSize(callee);
+            int limit = isHot(caller.blocks.at(i)) ? 2 * options.inlineSize : options.inlineSize;
+
+            if (caller.blocks.at(i).count != 0 && !isRecursive(callee) && size <= limit && procedureSize(caller) + size <= options.inlineGrowth) {
+                inlineCall(caller, i, j, callee);
+                ++count;
+                break;
+            }
+        }
+    }
+
+    if (options.report && count > 0) {
+        cerr << "inliner: " << count << " calls inlined into " << caller.name << endl;
+    }
+}
+
+// Index of a call whose result the block returns straight away, either itself
+// or by jumping to a block that only returns it, or -1
+int tailCallIndex(Procedure& procedure, int block) {
+    vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+    Instruction& terminator = instructions.back();
+    int position = instructions.size() - 2;
+    int returned = -1;
+
+    if (terminator.opcode == Opcode::RETURN) {
+        returned = terminator.operands.at(0);
+    } else if (terminator.opcode == Opcode::JUMP && procedure.blocks.at(terminator.target).instructions.size() == 1
+        && procedure.blocks.at(terminator.target).instructions.back().opcode == Opcode::RETURN) {
+        returned = procedure.blocks.at(terminator.target).instructions.back().operands.at(0);
+    } else {
+        return -1;
+    }
+
+    if (position >= 0 && instructions.at(position).opcode == Opcode::COPY && instructions.at(position).destination == returned) {
+        returned = instructions.at(position--).operands.at(0);
+    }
+
+    if (position >= 0 && instructions.at(position).opcode == Opcode::CALL && instructions.at(position).destination == returned) {
+        return position;
+    }
+
+    return -1;
+}
+
+// Whether the procedure takes the address of a variable or puts an array in its
+// frame. A pointer into the frame may then reach a callee, so a tail call must
+// not reuse the frame while the callee runs
+bool takesFrameAddresses(Procedure& procedure) {
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.opcode == Opcode::ADDRESS_LOCAL) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Turns calls of a procedure to itself in tail position into assignments to
+// the parameters and a jump back to the start of the body, which runs the
+// declarations again. Procedures can only call earlier ones, so recursion is
+// never mutual and this covers all of it
+void eliminateTailRecursion(Procedure& procedure) {
+    unordered_map<int, int> parameterRegisters;
+    vector<int> tails;
+    int prefix = 0;
+
+    if (takesFrameAddresses(procedure)) {
+        return;
+    }
+
+    for (Instruction& instruction : procedure.blocks.at(0).instructions) {
+        if (instruction.opcode != Opcode::LOAD_LOCAL || procedure.variableSlots.find(instruction.destination) == procedure.variableSlots.end()) {
+            break;
+        }
+
+        parameterRegisters[instruction.immediate] = instruction.destination;
+        ++prefix;
+    }
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        int index = tailCallIndex(procedure, i);
+
+        if (index != -1 && procedure.blocks.at(i).instructions.at(index).symbol == procedure.name) {
+            tails.push_back(i);
+        }
+    }
+
+    if (tails.empty()) {
+        return;
+    }
+
+    int head = newBlock(procedure);
+    vector<Instruction>& entry = procedure.blocks.at(0).instructions;
+
+    procedure.blocks.at(head).instructions.assign(entry.begin() + prefix, entry.end());
+    entry.erase(entry.begin() + prefix, entry.end());
+    appendJump(procedure, 0, head);
+
+    for (int tail : tails) {
+        int block = tail == 0 ? head : tail;
+        vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+        int index = tailCallIndex(procedure, block);
+        Instruction call = instructions.at(index);
+        vector<int> values;
+
+        instructions.erase(instructions.begin() + index, instructions.end());
+
+        // Arguments that read parameter variables are copied first, since the
+        // parameters are assigned one at a time
+        for (int argument : call.operands) {
+            if (procedure.variableSlots.find(argument) != procedure.variableSlots.end()) {
+                values.push_back(newRegister(procedure, procedure.registers.at(argument)));
+                instructions.push_back(createInstruction(Opcode::COPY, values.back(), { argument }));
+            } else {
+                values.push_back(argument);
+            }
+        }
+
+        for (int i = 0; i < values.size(); ++i) {
+            int offset = procedure.parameters.at(i);
+
+            if (parameterRegisters.find(offset) != parameterRegisters.end()) {
+                instructions.push_back(createInstruction(Opcode::COPY, parameterRegisters[offset], { values.at(i) }));
+            } else {
+                instructions.push_back(createInstruction(Opcode::STORE_LOCAL, -1, { values.at(i) }, offset));
+            }
+        }
+
+        appendJump(procedure, block, head);
+    }
+}
+
+// Inserts an empty block at the given index and renumbers the targets of the
+// blocks that move up
+void insertBlock(Procedure& procedure, int position) {
+    BasicBlock block;
+    block.label = generateLabel();
+
+    for (BasicBlock& other : procedure.blocks) {
+        Instruction& terminator = other.instructions.back();
+
+        if (terminator.target >= position) {
+            ++terminator.target;
+        }
+
+        if (terminator.alternative >= position) {
+            ++terminator.alternative;
+        }
+    }
+
+    procedure.blocks.insert(procedure.blocks.begin() + position, block);
+}
+
+// Puts a block that only jumps to the header in front of a loop and sends
+// every entry into the loop through it. The loop is renumbered to match
+int insertPreheader(Procedure& procedure, Loop& loop) {
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    vector<int> entries;
+    set<int> blocks;
+
+    for (int predecessor : graph.predecessors.at(loop.header)) {
+        if (loop.blocks.find(predecessor) == loop.blocks.end()) {
+            entries.push_back(predecessor < loop.header ? predecessor : predecessor + 1);
+        }
+    }
+
+    insertBlock(procedure, loop.header);
+
+    for (int entry : entries) {
+        Instruction& terminator = procedure.blocks.at(entry).instructions.back();
+
+        if (terminator.target == loop.header + 1) {
+            terminator.target = loop.header;
+        }
+
+        if (terminator.alternative == loop.header + 1) {
+            terminator.alternative = loop.header;
+        }
+    }
+
+    for (int block : loop.blocks) {
+        blocks.insert(block < loop.header ? block : block + 1);
+    }
+
+    appendJump(procedure, loop.header, loop.header + 1);
+    loop.blocks = blocks;
+
+    return loop.header++;
+}
+
+// Moves the computations of a loop that give the same value on every iteration
+// into a preheader that runs once before the header. Loads stay unless nothing
+// in the loop could write the memory they read, and loads and divisions may
+// fault, so they only move from the start of the header where nothing else
+// happens first. Constants move only along with something that uses them
+int hoistInvariants(Procedure& procedure, Loop& loop) {
+    ReachingDefinitions reaching = computeReachingDefinitions(procedure);
+    vector<int> definitionCounts(procedure.registers.size(), 0);
+    unordered_set<int> addressed;
+    unordered_set<int> storedLocals;
+    bool writesMemory = false;
+    bool writesAddressed = false;
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if (instruction.destination != -1) {
+                ++definitionCounts.at(instruction.destination);
+            }
+
+            if (instruction.opcode == Opcode::ADDRESS_LOCAL) {
+                addressed.insert(instruction.immediate);
+            }
+        }
+    }
+
+    for (int block : loop.blocks) {
+        for (Instruction& instruction : procedure.blocks.at(block).instructions) {
+            if (instruction.opcode == Opcode::STORE_LOCAL) {
+                storedLocals.insert(instruction.immediate);
+            } else if (instruction.opcode == Opcode::STORE || instruction.opcode == Opcode::CALL 
+                || instruction.opcode == Opcode::NEW || instruction.opcode == Opcode::DELETE) {
+                writesMemory = true;
+            }
+        }
+    }
+
+    for (int offset : storedLocals) {
+        writesAddressed = writesAddressed || addressed.find(offset) != addressed.end();
+    }
+
+    set<pair<int, int>> marked;
+    vector<pair<int, int>> invariants;
+    bool changed = true;
+
+    auto isInvariant = [&](int block, int index, bool blocked) {
+        Instruction& instruction = procedure.blocks.at(block).instructions.at(index);
+
+        if (instruction.destination == -1 || definitionCounts.at(instruction.destination) != 1 
+            || instruction.opcode == Opcode::CALL || instruction.opcode == Opcode::NEW) {
+            return false;
+        } else if (instruction.opcode == Opcode::LOAD_LOCAL && (storedLocals.find(instruction.immediate) != storedLocals.end() 
+            || (writesMemory && addressed.find(instruction.immediate) != addressed.end()))) {
+            return false;
+        } else if (instruction.opcode == Opcode::LOAD && (blocked || writesMemory || writesAddressed)) {
+            return false;
+        } else if ((instruction.opcode == Opcode::DIVIDE || instruction.opcode == Opcode::MODULO) && blocked) {
+            return false;
+        }
+
+        for (int operand : instruction.operands) {
+            vector<int> definitions = reachingDefinitions(procedure, reaching, block, index, operand);
+
+            for (int number : definitions) {
+                pair<int, int> position = reaching.positions.at(number);
+
+                if (loop.blocks.find(position.first) != loop.blocks.end() && (definitions.size() != 1 || marked.find(position) == marked.end())) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    };
+
+    while (changed) {
+        changed = false;
+
+        for (int block : loop.blocks) {
+            bool blocked = block != loop.header;
+
+            for (int i = 0; i < procedure.blocks.at(block).instructions.size(); ++i) {
+                bool isMarked = marked.find({ block, i }) != marked.end();
+
+                if (!isMarked && isInvariant(block, i, blocked)) {
+                    marked.insert({ block, i });
+                    invariants.push_back({ block, i });
+                    isMarked = true;
+                    changed = true;
+                }
+
+                blocked = blocked || (!isMarked && hasSideEffects(procedure.blocks.at(block).instructions.at(i)));
+            }
+        }
+    }
+
+    set<pair<int, int>> hoisted;
+    vector<pair<int, int>> worklist;
+    int count = 0;
+
+    for (pair<int, int> position : invariants) {
+        if (procedure.blocks.at(position.first).instructions.at(position.second).opcode != Opcode::CONSTANT) {
+            hoisted.insert(position);
+            worklist.push_back(position);
+            ++count;
+        }
+    }
+
+    while (!worklist.empty()) {
+        pair<int, int> current = worklist.back();
+        worklist.pop_back();
+
+        for (int operand : procedure.blocks.at(current.first).instructions.at(current.second).operands) {
+            for (int number : reachingDefinitions(procedure, reaching, current.first, current.second, operand)) {
+                pair<int, int> position = reaching.positions.at(number);
+
+                if (marked.find(position) != marked.end() && hoisted.insert(position).second) {
+                    worklist.push_back(position);
+                }
+            }
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    vector<Instruction> preheader;
+
+    for (pair<int, int> position : invariants) {
+        if (hoisted.find(position) != hoisted.end()) {
+            preheader.push_back(procedure.blocks.at(position.first).instructions.at(position.second));
+        }
+    }
+
+    for (set<pair<int, int>>::reverse_iterator position = hoisted.rbegin(); position != hoisted.rend(); ++position) {
+        vector<Instruction>& instructions = procedure.blocks.at(position->first).instructions;
+        instructions.erase(instructions.begin() + position->second);
+    }
+
+    vector<Instruction>& instructions = procedure.blocks.at(insertPreheader(procedure, loop)).instructions;
+    instructions.insert(instructions.begin(), preheader.begin(), preheader.end());
+
+    return count;
+}
+
+// Handles inner loops first, so what leaves them can move again out of the
+// loops around them
+void moveLoopInvariants(Procedure& procedure) {
+    unordered_set<string> visited;
+
+    while (true) {
+        vector<Loop> loops = findLoops(procedure);
+        int index = 0;
+
+        while (index < loops.size() && visited.find(procedure.blocks.at(loops.at(index).header).label) != visited.end()) {
+            ++index;
+        }
+
+        if (index == loops.size()) {
+            break;
+        }
+
+        string label = procedure.blocks.at(loops.at(index).header).label;
+        int count = hoistInvariants(procedure, loops.at(index));
+
+        visited.insert(label);
+
+        if (options.report) {
+            cerr << "loop invariant motion: " << count << " expressions hoisted from loop " << label << " in " << procedure.name << endl;
+        }
+    }
+}
+
+// Whether one of the blocks runs on every trip around the loop, which it does
+// when it dominates each block that jumps back to the header
+bool runsEveryTrip(Procedure& procedure, Loop& loop, set<int>& blocks) {
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    vector<int> dominators = computeDominators(procedure);
+
+    for (int block : blocks) {
+        bool isDominating = true;
+
+        for (int latch : graph.predecessors.at(loop.header)) {
+            if (loop.blocks.find(latch) != loop.blocks.end() && !dominates(dominators, block, latch)) {
+                isDominating = false;
+            }
+        }
+
+        if (isDominating) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Replaces pointer arithmetic that indexes an invariant pointer with a basic
+// induction variable, one whose only change in the loop is a constant step, by
+// a pointer that starts in a preheader and steps right after the variable
+// does. When the loop exits on the variable reaching an invariant bound one at
+// a time and the walk is dereferenced on every trip, so it cannot wrap around
+// memory, the exit test compares the pointer with the address of the bound
+// instead, so the counter can die. A guard in the preheader keeps loops that
+// never run from comparing addresses at all
+int walkPointers(Procedure& procedure, Loop& loop, bool& isRewritten) {
+    unordered_map<int, int> constants = constantRegisters(procedure);
+    vector<int> definitionCounts(procedure.registers.size(), 0);
+    vector<int> loopDefinitions(procedure.registers.size(), 0);
+    vector<int> useCounts(procedure.registers.size(), 0);
+    unordered_map<int, pair<int, int>> steps;
+    map<tuple<int, int, Opcode>, vector<pair<int, int>>> derived;
+
+    isRewritten = false;
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            for (int operand : instruction.operands) {
+                ++useCounts.at(operand);
+            }
+
+            if (instruction.destination != -1) {
+                ++definitionCounts.at(instruction.destination);
+                loopDefinitions.at(instruction.destination) += loop.blocks.find(i) != loop.blocks.end();
+            }
+        }
+    }
+
+    for (int block : loop.blocks) {
+        vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+
+        for (int i = 0; i < instructions.size(); ++i) {
+            Instruction& instruction = instructions.at(i);
+
+            if ((instruction.opcode == Opcode::ADD || instruction.opcode == Opcode::SUBTRACT) && loopDefinitions.at(instruction.destination) == 1
+                && instruction.operands.at(0) == instruction.destination && constants.find(instruction.operands.at(1)) != constants.end()) {
+                steps[instruction.destination] = { block, i };
+            }
+        }
+    }
+
+    for (int block : loop.blocks) {
+        vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+
+        for (int i = 0; i < instructions.size(); ++i) {
+            Instruction& instruction = instructions.at(i);
+
+            if ((instruction.opcode == Opcode::POINTER_ADD || instruction.opcode == Opcode::POINTER_SUBTRACT) && instruction.operands.size() == 2
+                && steps.find(instruction.operands.at(1)) != steps.end() && loopDefinitions.at(instruction.operands.at(0)) == 0
+                && definitionCounts.at(instruction.destination) == 1) {
+                derived[{ instruction.operands.at(0), instruction.operands.at(1), instruction.opcode }].push_back({ block, i });
+            }
+        }
+    }
+
+    if (derived.empty()) {
+        return 0;
+    }
+
+    vector<Instruction> preheader;
+    map<pair<int, int>, vector<Instruction>> advances;
+    unordered_map<int, int> pointers;
+    unordered_map<int, set<int>> dereferences;
+
+    for (auto& group : derived) {
+        int base = get<0>(group.first);
+        int variable = get<1>(group.first);
+        Opcode opcode = get<2>(group.first);
+        int pointer = newRegister(procedure, Type::INTSTAR);
+        Instruction& step = procedure.blocks.at(steps[variable].first).instructions.at(steps[variable].second);
+        bool isForward = (step.opcode == Opcode::ADD) == (opcode == Opcode::POINTER_ADD);
+
+        preheader.push_back(createInstruction(opcode, pointer, { base, variable }));
+        advances[steps[variable]].push_back(createInstruction(isForward ? Opcode::POINTER_ADD : Opcode::POINTER_SUBTRACT, pointer, { pointer, step.operands.at(1) }));
+
+        if (opcode == Opcode::POINTER_ADD) {
+            pointers[variable] = pointer;
+        }
+
+        // The pointer equals the sum everywhere in the loop, so uses that see
+        // the same value of the variable read the pointer directly
+        for (pair<int, int> position : group.second) {
+            vector<Instruction>& instructions = procedure.blocks.at(position.first).instructions;
+            int value = instructions.at(position.second).destination;
+            vector<int*> uses;
+
+            for (int i = position.second + 1; i < instructions.size() && instructions.at(i - 1).destination != variable; ++i) {
+                for (int& operand : instructions.at(i).operands) {
+                    if (operand == value) {
+                        uses.push_back(&operand);
+                    }
+                }
+
+                if ((instructions.at(i).opcode == Opcode::LOAD || instructions.at(i).opcode == Opcode::STORE) && instructions.at(i).operands.at(0) == value) {
+                    dereferences[pointer].insert(position.first);
+                }
+            }
+
+            instructions.at(position.second) = createInstruction(Opcode::COPY, value, { pointer });
+
+            if (uses.size() == useCounts.at(value)) {
+                for (int* operand : uses) {
+                    *operand = pointer;
+                }
+            }
+        }
+    }
+
+    unordered_set<int> increments;
+
+    for (auto& step : steps) {
+        Instruction& instruction = procedure.blocks.at(step.second.first).instructions.at(step.second.second);
+
+        if (instruction.opcode == Opcode::ADD && constants[instruction.operands.at(1)] == 1) {
+            increments.insert(step.first);
+        }
+    }
+
+    for (map<pair<int, int>, vector<Instruction>>::reverse_iterator advance = advances.rbegin(); advance != advances.rend(); ++advance) {
+        vector<Instruction>& instructions = procedure.blocks.at(advance->first.first).instructions;
+        instructions.insert(instructions.begin() + advance->first.second + 1, advance->second.begin(), advance->second.end());
+    }
+
+    vector<Instruction>& header = procedure.blocks.at(loop.header).instructions;
+    Instruction& branch = header.back();
+    int exit = -1;
+
+    if (branch.opcode == Opcode::BRANCH && header.size() >= 2 && loop.blocks.find(branch.target) != loop.blocks.end()
+        && loop.blocks.find(branch.alternative) == loop.blocks.end()) {
+        exit = branch.alternative;
+    }
+
+    if (exit != -1) {
+        Instruction& test = header.at(header.size() - 2);
+        bool isLess = test.opcode == Opcode::LESS_THAN;
+        int variable = isLess ? test.operands.at(0) : test.operands.at(1);
+        int bound = isLess ? test.operands.at(1) : test.operands.at(0);
+
+        if ((test.opcode == Opcode::LESS_THAN || test.opcode == Opcode::GREATER_THAN) && test.destination == branch.operands.at(0)
+            && useCounts.at(test.destination) == 1 && !test.isUnsigned && pointers.find(variable) != pointers.end() && loopDefinitions.at(bound) == 0
+            && increments.find(variable) != increments.end() && runsEveryTrip(procedure, loop, dereferences[pointers[variable]])) {
+            int base = -1;
+            int limit = newRegister(procedure, Type::INTSTAR);
+            int guard = newRegister(procedure, Type::INT);
+
+            for (Instruction& instruction : preheader) {
+                if (instruction.destination == pointers[variable]) {
+                    base = instruction.operands.at(0);
+                }
+            }
+
+            preheader.push_back(createInstruction(Opcode::POINTER_ADD, limit, { base, bound }));
+            preheader.push_back(test);
+            preheader.back().destination = guard;
+
+            test.operands = isLess ? vector<int>({ pointers[variable], limit }) : vector<int>({ limit, pointers[variable] });
+            test.isUnsigned = true;
+            isRewritten = true;
+        }
+    }
+
+    int block = insertPreheader(procedure, loop);
+    vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+
+    instructions.insert(instructions.begin(), preheader.begin(), preheader.end());
+
+    if (isRewritten) {
+        instructions.pop_back();
+        appendBranch(procedure, block, preheader.back().destination, loop.header, exit < block ? exit : exit + 1);
+    }
+
+    removeUnusedValues(procedure);
+
+    return derived.size();
+}
+
+void optimizeInductionVariables(Procedure& procedure) {
+    unordered_set<string> visited;
+
+    while (true) {
+        vector<Loop> loops = findLoops(procedure);
+        int index = 0;
+
+        while (index < loops.size() && visited.find(procedure.blocks.at(loops.at(index).header).label) != visited.end()) {
+            ++index;
+        }
+
+        if (index == loops.size()) {
+            break;
+        }
+
+        string label = procedure.blocks.at(loops.at(index).header).label;
+        bool isRewritten;
+        int count = walkPointers(procedure, loops.at(index), isRewritten);
+
+        visited.insert(label);
+
+        if (options.report && count > 0) {
+            cerr << "induction variables: " << count << " pointers walked in loop " << label << " in " << procedure.name
+                << (isRewritten ? ", exit test uses the pointer" : "") << endl;
+        }
+    }
+}
+
+// Steps a variable by a constant, the only change to a basic induction variable
+bool isStep(Instruction& instruction, unordered_map<int, int>& constants) {
+    return (instruction.opcode == Opcode::ADD || instruction.opcode == Opcode::SUBTRACT || instruction.opcode == Opcode::POINTER_ADD 
+        || instruction.opcode == Opcode::POINTER_SUBTRACT) && instruction.operands.size() == 2 && instruction.destination == instruction.operands.at(0) 
+        && constants.find(instruction.operands.at(1)) != constants.end() && abs(constants[instruction.operands.at(1)]) < (1 << 20);
+}
+
+// Unrolls a loop whose header only tests a counter against an invariant bound,
+// with the counter stepped by a constant once on every iteration. The unrolled
+// loop runs while a whole round of iterations stays within the bound, and the
+// original loop runs what is left. Inside the copies every variable stepped
+// once per iteration is read at its offset from the start of the round and
+// stepped once at the end of it, which leaves constant offsets for address
+// arithmetic to fold. The bound less a round of steps must not wrap, which the
+// preheader checks before entering the unrolled loop
+int unrollLoop(Procedure& procedure, Loop& loop, unordered_set<string>& visited) {
+    unordered_map<int, int> constants = constantRegisters(procedure);
+    vector<Instruction>& header = procedure.blocks.at(loop.header).instructions;
+    vector<int> loopDefinitions(procedure.registers.size(), 0);
+    vector<int> useCounts(procedure.registers.size(), 0);
+    vector<int> body;
+    int size = 0;
+
+    if (header.size() < 2 || header.back().opcode != Opcode::BRANCH || header.back().operands.at(0) != header.at(header.size() - 2).destination
+        || loop.blocks.find(header.back().target) == loop.blocks.end() || loop.blocks.find(header.back().alternative) != loop.blocks.end()) {
+        return 0;
+    }
+
+    for (int i = 0; i < header.size() - 2; ++i) {
+        if (header.at(i).opcode != Opcode::CONSTANT) {
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            for (int operand : instruction.operands) {
+                ++useCounts.at(operand);
+            }
+
+            if (instruction.destination != -1 && loop.blocks.find(i) != loop.blocks.end()) {
+                ++loopDefinitions.at(instruction.destination);
+            }
+        }
+
+        if (loop.blocks.find(i) != loop.blocks.end() && i != loop.header) {
+            body.push_back(i);
+            size += procedure.blocks.at(i).instructions.size();
+
+            for (int successor : successors(procedure.blocks.at(i))) {
+                if (loop.blocks.find(successor) == loop.blocks.end()) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    for (Loop& other : findLoops(procedure)) {
+        if (other.header != loop.header && loop.blocks.find(other.header) != loop.blocks.end()) {
+            return 0;
+        }
+    }
+
+    int factor = min(options.unrollFactor, options.unrollSize / max(size, 1));
+    Instruction test = header.at(header.size() - 2);
+    bool isLess = test.opcode == Opcode::LESS_THAN || test.opcode == Opcode::LESS_EQUAL;
+    long long iterations = 0;
+
+    // A profile shows loops that never ran or that average too few iterations
+    // per entry to reach the unrolled body, the header running once more than
+    // the body each time
+    for (int block : body) {
+        Instruction& terminator = procedure.blocks.at(block).instructions.back();
+        long long count = procedure.blocks.at(block).count;
+
+        if (terminator.target == loop.header || terminator.alternative == loop.header) {
+            iterations = count < 0 || iterations < 0 ? -1 : iterations + count;
+        }
+    }
+
+    long long entries = procedure.blocks.at(loop.header).count - iterations;
+
+    if (procedure.blocks.at(loop.header).count == 0 || (iterations >= 0 && entries > 0 && iterations < factor * entries)) {
+        return 0;
+    }
+
+    if (factor < 2 || (!isLess && test.opcode != Opcode::GREATER_THAN && test.opcode != Opcode::GREATER_EQUAL) || useCounts.at(test.destination) != 1) {
+        return 0;
+    }
+
+    // Variables stepped exactly once on every iteration, found by the position
+    // of their step, which has to dominate every way back to the header
+    vector<int> dominators = computeDominators(procedure);
+    map<int, pair<int, int>> steps;
+
+    for (int block : body) {
+        vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+        bool isEveryIteration = true;
+
+        for (int latch : body) {
+            if (procedure.blocks.at(latch).instructions.back().target == loop.header || procedure.blocks.at(latch).instructions.back().alternative == loop.header) {
+                isEveryIteration = isEveryIteration && dominates(dominators, block, latch);
+            }
+        }
+
+        for (int i = 0; i < instructions.size() && isEveryIteration; ++i) {
+            if (isStep(instructions.at(i), constants) && loopDefinitions.at(instructions.at(i).destination) == 1) {
+                steps[instructions.at(i).destination] = { block, i };
+            }
+        }
+    }
+
+    int counter = test.operands.at(0);
+    int bound = test.operands.at(1);
+
+    if (steps.find(counter) == steps.end()) {
+        swap(counter, bound);
+    }
+
+    if (steps.find(counter) == steps.end() || (loopDefinitions.at(bound) != 0 && constants.find(bound) == constants.end())) {
+        return 0;
+    }
+
+    // The counter moves toward the bound when it is on the smaller side of the
+    // test and increases, or on the larger side and decreases
+    Instruction step = procedure.blocks.at(steps[counter].first).instructions.at(steps[counter].second);
+    bool isIncreasing = (constants[step.operands.at(1)] > 0) == (step.opcode == Opcode::ADD || step.opcode == Opcode::POINTER_ADD);
+    long long distance = static_cast<long long>(abs(constants[step.operands.at(1)])) * (factor - 1);
+
+    if (constants[step.operands.at(1)] == 0 || distance > (1 << 24) || isIncreasing != (isLess == (counter == test.operands.at(0)))) {
+        return 0;
+    }
+
+    // A constant bound gives a constant limit, and a limit that wraps means no
+    // round ever fits
+    long long constantLimit = 0;
+
+    if (constants.find(bound) != constants.end()) {
+        long long value = test.isUnsigned ? static_cast<unsigned int>(constants[bound]) : constants[bound];
+
+        constantLimit = isIncreasing ? value - distance : value + distance;
+
+        if (procedure.registers.at(bound) != Type::INT || constantLimit < (test.isUnsigned ? 0 : INT_MIN) 
+            || constantLimit > (test.isUnsigned ? UINT_MAX : INT_MAX)) {
+            return 0;
+        }
+    }
+
+    Liveness liveness = computeLiveness(procedure);
+    set<int> carried = liveness.liveIn.at(loop.header);
+    int entry = header.back().target;
+
+    // Each copy renames the values that do not live from one iteration to the
+    // next, and reads stepped variables at their offset within the round
+    int preheader = insertPreheader(procedure, loop);
+    auto shifted = [preheader](int block) { return block < preheader ? block : block + 1; };
+
+    entry = shifted(entry);
+    dominators = computeDominators(procedure);
+
+    for (int& block : body) {
+        block = shifted(block);
+    }
+
+    for (auto& position : steps) {
+        position.second.first = shifted(position.second.first);
+    }
+
+    // The copies are entered through a new header, which needs its own copy of
+    // the constants of the old one
+    int unrolled = newBlock(procedure);
+    unordered_map<int, int> headerConstants;
+    map<pair<int, int>, int> copies;
+
+    for (int i = 0; i < procedure.blocks.at(loop.header).instructions.size() - 2; ++i) {
+        Instruction instruction = procedure.blocks.at(loop.header).instructions.at(i);
+        int constant = newRegister(procedure, procedure.registers.at(instruction.destination));
+
+        headerConstants[instruction.destination] = constant;
+        instruction.destination = constant;
+        procedure.blocks.at(unrolled).instructions.push_back(instruction);
+    }
+
+    for (int i = 0; i < factor; ++i) {
+        for (int block : body) {
+            copies[{ i, block }] = newBlock(procedure);
+        }
+    }
+
+    map<pair<int, int>, int> offsets;
+    vector<Instruction> starts;
+    vector<Instruction> hoisted;
+
+    auto offsetOf = [&](int variable, int round) {
+        if (round == 0) {
+            return variable;
+        }
+
+        if (offsets.find({ variable, round }) == offsets.end()) {
+            Instruction& original = procedure.blocks.at(steps[variable].first).instructions.at(steps[variable].second);
+            int constant = newRegister(procedure, Type::INT);
+            int value = newRegister(procedure, procedure.registers.at(variable));
+
+            hoisted.push_back(createInstruction(Opcode::CONSTANT, constant, {}, constants[original.operands.at(1)] * round));
+            starts.push_back(createInstruction(original.opcode, value, { variable, constant }));
+            offsets[{ variable, round }] = value;
+        }
+
+        return offsets[{ variable, round }];
+    };
+
+    for (int i = 0; i < factor; ++i) {
+        unordered_map<int, int> renamed = headerConstants;
+
+        for (int block : body) {
+            for (Instruction& instruction : procedure.blocks.at(block).instructions) {
+                int destination = instruction.destination;
+
+                if (destination != -1 && carried.find(destination) == carried.end() && steps.find(destination) == steps.end() 
+                    && renamed.find(destination) == renamed.end()) {
+                    renamed[destination] = newRegister(procedure, procedure.registers.at(destination));
+                }
+            }
+        }
+
+        for (int block : body) {
+            vector<Instruction>& instructions = procedure.blocks.at(copies[{ i, block }]).instructions;
+
+            for (int j = 0; j < procedure.blocks.at(block).instructions.size(); ++j) {
+                Instruction& original = procedure.blocks.at(block).instructions.at(j);
+                Instruction instruction = original;
+
+                for (int& operand : instruction.operands) {
+                    if (steps.find(operand) != steps.end()) {
+                        pair<int, int> position = steps[operand];
+                        bool isAfter = block == position.first ? j > position.second : dominates(dominators, position.first, block);
+
+                        operand = i + isAfter == factor ? operand : offsetOf(operand, i + isAfter);
+                    } else if (renamed.find(operand) != renamed.end()) {
+                        operand = renamed[operand];
+                    }
+                }
+
+                if (steps.find(instruction.destination) != steps.end()) {
+                    if (i < factor - 1) {
+                        continue;
+                    }
+
+                    int constant = newRegister(procedure, Type::INT);
+
+                    hoisted.push_back(createInstruction(Opcode::CONSTANT, constant, {}, constants[original.operands.at(1)] * factor));
+                    instruction.operands = { instruction.destination, constant };
+                } else if (renamed.find(instruction.destination) != renamed.end()) {
+                    instruction.destination = renamed[instruction.destination];
+                }
+
+                if (instruction.target == loop.header) {
+                    instruction.target = i == factor - 1 ? unrolled : copies[{ i + 1, entry }];
+                } else if (instruction.target != -1) {
+                    instruction.target = copies[{ i, instruction.target }];
+                }
+
+                if (instruction.alternative == loop.header) {
+                    instruction.alternative = i == factor - 1 ? unrolled : copies[{ i + 1, entry }];
+                } else if (instruction.alternative != -1) {
+                    instruction.alternative = copies[{ i, instruction.alternative }];
+                }
+
+                instructions.push_back(instruction);
+            }
+        }
+    }
+
+    vector<Instruction>& first = procedure.blocks.at(copies[{ 0, entry }]).instructions;
+
+    first.insert(first.begin(), starts.begin(), starts.end());
+
+    int limit = newRegister(procedure, procedure.registers.at(bound));
+    int constant = newRegister(procedure, Type::INT);
+    Opcode opcode = step.opcode == Opcode::POINTER_ADD || step.opcode == Opcode::POINTER_SUBTRACT ? Opcode::POINTER_ADD : Opcode::ADD;
+    Instruction check = test;
+
+    procedure.blocks.at(preheader).instructions.pop_back();
+    procedure.blocks.at(preheader).instructions.insert(procedure.blocks.at(preheader).instructions.end(), hoisted.begin(), hoisted.end());
+
+    if (constants.find(bound) != constants.end()) {
+        procedure.blocks.at(preheader).instructions.push_back(createInstruction(Opcode::CONSTANT, limit, {}, static_cast<int>(constantLimit)));
+        appendJump(procedure, preheader, unrolled);
+    } else {
+        procedure.blocks.at(preheader).instructions.push_back(createInstruction(Opcode::CONSTANT, constant, {}, isIncreasing ? -distance : distance));
+        procedure.blocks.at(preheader).instructions.push_back(createInstruction(opcode, limit, { bound, constant }));
+
+        check.opcode = isIncreasing ? Opcode::LESS_THAN : Opcode::GREATER_THAN;
+        check.operands = { limit, bound };
+        check.destination = newRegister(procedure, Type::INT);
+        procedure.blocks.at(preheader).instructions.push_back(check);
+        appendBranch(procedure, preheader, check.destination, unrolled, loop.header);
+    }
+
+    test.operands = counter == test.operands.at(0) ? vector<int>({ counter, limit }) : vector<int>({ limit, counter });
+    test.destination = newRegister(procedure, Type::INT);
+    procedure.blocks.at(unrolled).instructions.push_back(test);
+    appendBranch(procedure, unrolled, test.destination, copies[{ 0, entry }], loop.header);
+
+    visited.insert(procedure.blocks.at(unrolled).label);
+    removeUnusedValues(procedure);
+
+    // The new blocks go between the preheader and the remainder loop, since
+    // values live in the loop would otherwise stay allocated up to the end
+    vector<int> mapping(procedure.blocks.size());
+
+    for (int i = 0; i < mapping.size(); ++i) {
+        mapping.at(i) = i <= preheader ? i : i < unrolled ? i + mapping.size() - unrolled : i - unrolled + preheader + 1;
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        Instruction& terminator = block.instructions.back();
+
+        terminator.target = terminator.target == -1 ? -1 : mapping.at(terminator.target);
+        terminator.alternative = terminator.alternative == -1 ? -1 : mapping.at(terminator.alternative);
+    }
+
+    rotate(procedure.blocks.begin() + preheader + 1, procedure.blocks.begin() + unrolled, procedure.blocks.end());
+
+    // Constants mostly end up as immediates and jumps to the next block fall
+    // through, so neither counts toward the instructions an iteration executes
+    if (options.report) {
+        auto executed = [&procedure](int block) {
+            int count = 0;
+
+            for (Instruction& instruction : procedure.blocks.at(block).instructions) {
+                count += instruction.opcode != Opcode::CONSTANT && (instruction.opcode != Opcode::JUMP || instruction.target != block + 1);
+            }
+
+            return count;
+        };
+        int before = 0;
+        int after = executed(mapping.at(unrolled));
+
+        for (int block : loop.blocks) {
+            before += executed(mapping.at(block));
+        }
+
+        for (auto& copy : copies) {
+            after += executed(mapping.at(copy.second));
+        }
+
+        cerr << "loop unrolling: loop " << procedure.blocks.at(mapping.at(loop.header)).label << " in " << procedure.name << " unrolled " << factor 
+            << " times, " << static_cast<double>(after) / factor << " instructions per iteration instead of " << before << endl;
+    }
+
+    return factor;
+}
+
+void unrollLoops(Procedure& procedure) {
+    unordered_set<string> visited;
+
+    while (true) {
+        vector<Loop> loops = findLoops(procedure);
+        int index = 0;
+
+        while (index < loops.size() && visited.find(procedure.blocks.at(loops.at(index).header).label) != visited.end()) {
+            ++index;
+        }
+
+        if (index == loops.size()) {
+            break;
+        }
+
+        visited.insert(procedure.blocks.at(loops.at(index).header).label);
+        unrollLoop(procedure, loops.at(index), visited);
+    }
+}
+
+// Register that always holds a constant, or an empty string
+string constantRegister(int value) {
+    switch (value) {
+        case 0: return "$0";
+        case 1: return "$11";
+        case 4: return "$4";
+        default: return "";
+    }
+}
+
+// Lets a branch compare the operands of the comparison computing its condition
+// rather than test the value. A constant the machine keeps in a register is
+// dropped in favour of that register
+void fuseBranches(Procedure& procedure) {
+    vector<int> useCounts(procedure.registers.size(), 0);
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            for (int operand : instruction.operands) {
+                ++useCounts.at(operand);
+            }
+        }
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        vector<Instruction>& instructions = block.instructions;
+        int length = instructions.size();
+
+        if (instructions.back().opcode != Opcode::BRANCH || length < 2) {
+            continue;
+        }
+
+        Instruction& comparison = instructions.at(length - 2);
+
+        if (!isComparison(comparison.opcode) || comparison.destination != instructions.back().operands.at(0) || useCounts.at(comparison.destination) != 1) {
+            continue;
+        }
+
+        instructions.back().operands = comparison.operands;
+        instructions.back().comparison = comparison.opcode;
+        instructions.back().isUnsigned = comparison.isUnsigned;
+        instructions.erase(instructions.end() - 2);
+
+        for (int k = 1; k >= 0 && instructions.back().operands.size() == 2; --k) {
+            int operand = instructions.back().operands.at(k);
+            int definition = instructions.size() - 2;
+
+            while (definition >= 0 && instructions.at(definition).destination != operand) {
+                --definition;
+            }
+
+            if (definition < 0 || instructions.at(definition).opcode != Opcode::CONSTANT || useCounts.at(operand) != 1 
+                || constantRegister(instructions.at(definition).immediate) == "") {
+                continue;
+            }
+
+            Instruction& branch = instructions.back();
+
+            branch.immediate = instructions.at(definition).immediate;
+            branch.operands.erase(branch.operands.begin() + k);
+
+            if (k == 0) {
+                switch (branch.comparison) {
+                    case Opcode::LESS_THAN: branch.comparison = Opcode::GREATER_THAN; break;
+                    case Opcode::GREATER_THAN: branch.comparison = Opcode::LESS_THAN; break;
+                    case Opcode::LESS_EQUAL: branch.comparison = Opcode::GREATER_EQUAL; break;
+                    case Opcode::GREATER_EQUAL: branch.comparison = Opcode::LESS_EQUAL; break;
+                    default: break;
+                }
+            }
+
+            instructions.erase(instructions.begin() + definition);
+        }
+    }
+}
+
+// Words the register emitter spends on an instruction whose operands and
+// result are already in registers
+int instructionCost(Instruction& instruction) {
+    switch (instruction.opcode) {
+        case Opcode::CONSTANT:
+            return constantRegister(instruction.immediate) == "" ? 2 : 0;
+
+        case Opcode::MULTIPLY:
+        case Opcode::DIVIDE:
+        case Opcode::MODULO:
+            return 2;
+
+        case Opcode::POINTER_ADD:
+        case Opcode::POINTER_SUBTRACT:
+            return instruction.operands.size() == 1 && constantRegister(4 * instruction.immediate) != "" ? 1 : 3;
+
+        case Opcode::POINTER_DIFFERENCE:
+        case Opcode::ADDRESS_LOCAL:
+            return 3;
+
+        default:
+            return 1;
+    }
+}
+
+// What a pattern emits for the root of a tree, the instructions of the tree it
+// makes unnecessary and the words it costs
+struct Cover {
+    Instruction root;
+    vector<int> absorbed;
+    int cost = INT_MAX;
+};
+
+struct SelectionState {
+    unordered_map<int, int> constants;
+    vector<int> useCounts;
+};
+
+// Position of the instruction computing a value that only the instruction at
+// the index uses, when it is earlier in the block and its operands still hold
+// the same values there, or -1
+int subtree(vector<Instruction>& instructions, int index, int value, SelectionState& state) {
+    if (state.useCounts.at(value) != 1) {
+        return -1;
+    }
+
+    for (int i = index - 1; i >= 0; --i) {
+        if (instructions.at(i).destination != value) {
+            continue;
+        }
+
+        for (int j = i + 1; j < index; ++j) {
+            for (int operand : instructions.at(i).operands) {
+                if (instructions.at(j).destination == operand) {
+                    return -1;
+                }
+            }
+        }
+
+        return hasSideEffects(instructions.at(i)) ? -1 : i;
+    }
+
+    return -1;
+}
+
+// lw and sw add a constant offset to their base register, which covers pointer
+// arithmetic with a constant index and the byte offsets strength reduction
+// leaves behind
+Cover coverOffsetAccess(vector<Instruction>& instructions, int index, SelectionState& state) {
+    Instruction& root = instructions.at(index);
+    Cover cover;
+
+    if (root.opcode != Opcode::LOAD && root.opcode != Opcode::STORE) {
+        return cover;
+    }
+
+    int address = subtree(instructions, index, root.operands.at(0), state);
+
+    if (address == -1) {
+        return cover;
+    }
+
+    Instruction& sum = instructions.at(address);
+    Opcode opcode = sum.opcode;
+
+    if (opcode != Opcode::POINTER_ADD && opcode != Opcode::POINTER_SUBTRACT && opcode != Opcode::ADD && opcode != Opcode::SUBTRACT) {
+        return cover;
+    }
+
+    int scale = opcode == Opcode::POINTER_ADD || opcode == Opcode::POINTER_SUBTRACT ? 4 : 1;
+    int base = sum.operands.at(0);
+    int constant = sum.operands.size() == 1 ? -1 : sum.operands.at(1);
+
+    if (opcode == Opcode::ADD && state.constants.find(base) != state.constants.end()) {
+        swap(base, constant);
+    }
+
+    if (constant != -1 && state.constants.find(constant) == state.constants.end()) {
+        return cover;
+    }
+
+    long long scaled = (long long)scale * (constant == -1 ? sum.immediate : state.constants[constant]);
+    long long offset = root.immediate + (opcode == Opcode::POINTER_ADD || opcode == Opcode::ADD ? scaled : -scaled);
+
+    if (offset < -32768 || offset > 32767) {
+        return cover;
+    }
+
+    cover.root = root;
+    cover.root.operands.at(0) = base;
+    cover.root.immediate = offset;
+    cover.absorbed.push_back(address);
+    cover.cost = 1;
+
+    if (constant != -1 && subtree(instructions, address, constant, state) != -1) {
+        cover.absorbed.push_back(subtree(instructions, address, constant, state));
+    }
+
+    return cover;
+}
+
+// Loads and stores through the address of a local reach its slot directly
+Cover coverFrameAccess(vector<Instruction>& instructions, int index, SelectionState& state) {
+    Instruction& root = instructions.at(index);
+    Cover cover;
+
+    if (root.opcode != Opcode::LOAD && root.opcode != Opcode::STORE) {
+        return cover;
+    }
+
+    int address = subtree(instructions, index, root.operands.at(0), state);
+
+    if (address == -1 || instructions.at(address).opcode != Opcode::ADDRESS_LOCAL) {
+        return cover;
+    }
+
+    cover.root = root;
+    cover.root.opcode = root.opcode == Opcode::LOAD ? Opcode::LOAD_LOCAL : Opcode::STORE_LOCAL;
+    cover.root.operands.erase(cover.root.operands.begin());
+    cover.root.immediate = instructions.at(address).immediate + root.immediate;
+    cover.absorbed.push_back(address);
+    cover.cost = 1;
+
+    return cover;
+}
+
+// Pointer arithmetic with a constant index scales it at compile time, and an
+// index of one adds $4
+Cover coverScaledConstant(vector<Instruction>& instructions, int index, SelectionState& state) {
+    Instruction& root = instructions.at(index);
+    Cover cover;
+
+    if ((root.opcode != Opcode::POINTER_ADD && root.opcode != Opcode::POINTER_SUBTRACT) || root.operands.size() != 2 
+        || state.constants.find(root.operands.at(1)) == state.constants.end() || abs(state.constants[root.operands.at(1)]) >= (1 << 29)) {
+        return cover;
+    }
+
+    int constant = subtree(instructions, index, root.operands.at(1), state);
+
+    cover.root = root;
+    cover.root.operands.pop_back();
+    cover.root.immediate = state.constants[root.operands.at(1)];
+    cover.cost = instructionCost(cover.root);
+
+    if (constant != -1) {
+        cover.absorbed.push_back(constant);
+    }
+
+    return cover;
+}
+
+typedef Cover (*SelectionPattern)(vector<Instruction>&, int, SelectionState&);
+
+const vector<pair<string, SelectionPattern>> SELECTION_PATTERNS = {
+    { "offset-access", coverOffsetAccess },
+    { "frame-access", coverFrameAccess },
+    { "scaled-constant", coverScaledConstant }
+};
+
+// Covers every instruction with the pattern that saves the most words over
+// emitting it and the trees it absorbs on their own. The rewritten root is
+// matched again, so patterns combine into larger trees. Selection is greedy
+// rather than a minimum cost cover over whole trees, which finds the same
+// cover for these patterns: at most one matches any root, since they need
+// different opcodes at the root or its address, every cover costs the single
+// word the root needs anyway, and the trees absorbed have no other use. An
+// address rewritten on its own first is still absorbed whole by the access
+void selectInstructions(Procedure& procedure, vector<int>& counts) {
+    SelectionState state;
+    state.constants = constantRegisters(procedure);
+    state.useCounts.assign(procedure.registers.size(), 0);
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            for (int operand : instruction.operands) {
+                ++state.useCounts.at(operand);
+            }
+        }
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        vector<Instruction>& instructions = block.instructions;
+
+        for (int i = 0; i < instructions.size(); ++i) {
+            while (true) {
+                int best = -1;
+                int bestSaving = 0;
+                Cover cover;
+
+                for (int j = 0; j < SELECTION_PATTERNS.size(); ++j) {
+                    Cover candidate = SELECTION_PATTERNS.at(j).second(instructions, i, state);
+
+                    if (candidate.cost == INT_MAX) {
+                        continue;
+                    }
+
+                    int saving = instructionCost(instructions.at(i)) - candidate.cost;
+
+                    for (int position : candidate.absorbed) {
+                        saving += instructionCost(instructions.at(position));
+                    }
+
+                    if (saving > bestSaving) {
+                        best = j;
+                        bestSaving = saving;
+                        cover = candidate;
+                    }
+                }
+
+                if (best == -1) {
+                    break;
+                }
+
+                for (int operand : instructions.at(i).operands) {
+                    --state.useCounts.at(operand);
+                }
+
+                for (int operand : cover.root.operands) {
+                    ++state.useCounts.at(operand);
+                }
+
+                instructions.at(i) = cover.root;
+                sort(cover.absorbed.rbegin(), cover.absorbed.rend());
+
+                for (int position : cover.absorbed) {
+                    for (int operand : instructions.at(position).operands) {
+                        --state.useCounts.at(operand);
+                    }
+
+                    instructions.erase(instructions.begin() + position);
+                    --i;
+                }
+
+                ++counts.at(best);
+            }
+        }
+    }
+
+    // Constants folded into uses in other blocks are left without any
+    removeUnusedValues(procedure);
+}
+
+// Words a taken branch wastes on top of its own, as the pipeline refills after
+// a branch that went the other way
+const int BRANCH_PENALTY = 2;
+
+// Instructions safe to run whichever way a branch would have gone, which rules
+// out memory other than the frame and divisions that may trap
+bool isSpeculable(Instruction& instruction) {
+    switch (instruction.opcode) {
+        case Opcode::CONSTANT:
+        case Opcode::COPY:
+        case Opcode::ADD:
+        case Opcode::SUBTRACT:
+        case Opcode::MULTIPLY:
+        case Opcode::POINTER_ADD:
+        case Opcode::POINTER_SUBTRACT:
+        case Opcode::LOAD_LOCAL:
+        case Opcode::ADDRESS_LOCAL:
+            return true;
+
+        default:
+            return isComparison(instruction.opcode);
+    }
+}
+
+// Turns an if and else that each assign one int variable into straight code.
+// Both sides run and the condition, 0 or 1, picks the result arithmetically
+// as else + condition * (then - else). Comparisons that would need more than
+// a single slt are inverted first, swapping the two sides. The cost model
+// compares the words of both versions, charging the branch for its penalty
+// and the taken jump out of one side
+bool convertBranch(Procedure& procedure, int block, vector<int>& definitionCounts, vector<int>& useCounts, int& kept) {
+    vector<Instruction>& instructions = procedure.blocks.at(block).instructions;
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    Instruction& branch = instructions.back();
+
+    if (branch.opcode != Opcode::BRANCH || instructions.size() < 2 || instructions.at(instructions.size() - 2).destination != branch.operands.at(0)
+        || !isComparison(instructions.at(instructions.size() - 2).opcode) || useCounts.at(branch.operands.at(0)) != 1 || branch.target == branch.alternative) {
+        return false;
+    }
+
+    vector<int> sides = { branch.target, branch.alternative };
+    vector<int> values(2, -1);
+    vector<int> costs(2, 0);
+    int variable = -1;
+    int join = -1;
+
+    for (int i = 0; i < 2; ++i) {
+        vector<Instruction>& side = procedure.blocks.at(sides.at(i)).instructions;
+
+        if (graph.predecessors.at(sides.at(i)).size() != 1 || side.back().opcode != Opcode::JUMP || (join != -1 && side.back().target != join)) {
+            return false;
+        }
+
+        join = side.back().target;
+
+        for (int j = 0; j < side.size() - 1; ++j) {
+            if (!isSpeculable(side.at(j))) {
+                return false;
+            }
+
+            if (definitionCounts.at(side.at(j).destination) != 1) {
+                if (values.at(i) != -1 || (variable != -1 && side.at(j).destination != variable)) {
+                    return false;
+                }
+
+                variable = side.at(j).destination;
+                values.at(i) = j;
+            }
+
+            costs.at(i) += instructionCost(side.at(j));
+        }
+
+        if (values.at(i) == -1) {
+            return false;
+        }
+    }
+
+    if (join == sides.at(0) || join == sides.at(1) || procedure.registers.at(variable) != Type::INT) {
+        return false;
+    }
+
+    Opcode opcode = instructions.at(instructions.size() - 2).opcode;
+    bool isInverted = opcode == Opcode::LESS_EQUAL || opcode == Opcode::GREATER_EQUAL || opcode == Opcode::EQUAL;
+    bool isEquality = opcode == Opcode::EQUAL || opcode == Opcode::NOT_EQUAL;
+    vector<bool> isKnown(2, false);
+    vector<int> knowns(2, 0);
+    int jumps = 0;
+    int straight = isEquality ? 2 : 1;
+    int branched = (isEquality ? 1 : 2) + BRANCH_PENALTY;
+
+    for (int i = 0; i < 2; ++i) {
+        vector<Instruction>& side = procedure.blocks.at(sides.at(i)).instructions;
+        Instruction& assignment = side.at(values.at(i));
+
+        // A side that only keeps the variable needs no code when branching, and
+        // a side that copies its result costs nothing once both run
+        if (side.size() == 2 && assignment.opcode == Opcode::COPY && assignment.operands.at(0) == variable) {
+            costs.at(i) = 0;
+        } else {
+            straight += costs.at(i) - (assignment.opcode == Opcode::COPY ? instructionCost(assignment) : 0);
+            ++jumps;
+        }
+
+        for (Instruction& instruction : side) {
+            if (instruction.opcode == Opcode::CONSTANT && (&instruction == &assignment
+                || (assignment.opcode == Opcode::COPY && instruction.destination == assignment.operands.at(0)))) {
+                isKnown.at(i) = true;
+                knowns.at(i) = instruction.immediate;
+            }
+        }
+    }
+
+    branched += (costs.at(0) + costs.at(1)) / 2 + jumps / 2;
+
+    // Constant sides fold the subtraction, and the multiplication and addition
+    // too when they differ by one or the other side is zero
+    if (isKnown.at(0) && isKnown.at(1)) {
+        int high = isInverted ? knowns.at(1) : knowns.at(0);
+        int low = isInverted ? knowns.at(0) : knowns.at(1);
+        Instruction difference = createInstruction(Opcode::CONSTANT, -1, {}, high - low);
+        Instruction base = createInstruction(Opcode::CONSTANT, -1, {}, low);
+
+        straight = (isEquality ? 2 : 1) + (high - low == 1 ? 0 : instructionCost(difference) + 2) + (low == 0 ? 0 : instructionCost(base) + 1);
+    } else {
+        straight += 4;
+    }
+
+    if (straight > branched) {
+        ++kept;
+
+        return false;
+    }
+
+    vector<Instruction> code(instructions.begin(), instructions.end() - 1);
+    vector<int> results(2);
+
+    if (isInverted) {
+        swap(sides.at(0), sides.at(1));
+        swap(values.at(0), values.at(1));
+
+        switch (opcode) {
+            case Opcode::LESS_EQUAL: code.back().opcode = Opcode::GREATER_THAN; break;
+            case Opcode::GREATER_EQUAL: code.back().opcode = Opcode::LESS_THAN; break;
+            default: code.back().opcode = Opcode::NOT_EQUAL; break;
+        }
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        vector<Instruction>& side = procedure.blocks.at(sides.at(i)).instructions;
+
+        results.at(i) = newRegister(procedure, Type::INT);
+
+        for (int j = 0; j < side.size() - 1; ++j) {
+            Instruction instruction = side.at(j);
+
+            for (int& operand : instruction.operands) {
+                operand = operand == variable && j > values.at(i) ? results.at(i) : operand;
+            }
+
+            instruction.destination = j == values.at(i) ? results.at(i) : instruction.destination;
+            code.push_back(instruction);
+        }
+    }
+
+    int difference = newRegister(procedure, Type::INT);
+    int product = newRegister(procedure, Type::INT);
+
+    code.push_back(createInstruction(Opcode::SUBTRACT, difference, { results.at(0), results.at(1) }));
+    code.push_back(createInstruction(Opcode::MULTIPLY, product, { code.at(instructions.size() - 2).destination, difference }));
+    code.push_back(createInstruction(Opcode::ADD, variable, { results.at(1), product }));
+    code.push_back(createInstruction(Opcode::JUMP, -1, {}));
+    code.back().target = join;
+    instructions = code;
+
+    return true;
+}
+
+void convertBranches(Procedure& procedure) {
+    int count = 0;
+    int kept = 0;
+    bool changed = true;
+
+    while (changed) {
+        vector<int> definitionCounts(procedure.registers.size(), 0);
+        vector<int> useCounts(procedure.registers.size(), 0);
+
+        changed = false;
+
+        for (BasicBlock& block : procedure.blocks) {
+            for (Instruction& instruction : block.instructions) {
+                for (int operand : instruction.operands) {
+                    ++useCounts.at(operand);
+                }
+
+                if (instruction.destination != -1) {
+                    ++definitionCounts.at(instruction.destination);
+                }
+            }
+        }
+
+        for (int i = 0; i < procedure.blocks.size() && !changed; ++i) {
+            changed = convertBranch(procedure, i, definitionCounts, useCounts, kept);
+        }
+
+        if (changed) {
+            removeUnreachableBlocks(procedure);
+            ++count;
+        }
+    }
+
+    if (options.report) {
+        cerr << "if-conversion: " << count << " branches removed in " << procedure.name << ", " << kept << " kept by the cost model" << endl;
+    }
+}
+
+// Frame slots a local occupies when the instruction reads or writes it,
+// counting the slot a promoted variable spills to wherever the variable is
+void slotAccesses(Procedure& procedure, Instruction& instruction, vector<int>& uses, vector<int>& definitions) {
+    uses.clear();
+    definitions.clear();
+
+    for (int operand : instruction.operands) {
+        if (procedure.variableSlots.find(operand) != procedure.variableSlots.end() && procedure.variableSlots[operand] <= 0) {
+            uses.push_back(procedure.variableSlots[operand]);
+        }
+    }
+
+    if (instruction.opcode == Opcode::LOAD_LOCAL && instruction.immediate <= 0) {
+        uses.push_back(instruction.immediate);
+    }
+
+    if (instruction.opcode == Opcode::STORE_LOCAL && instruction.immediate <= 0) {
+        definitions.push_back(instruction.immediate);
+    }
+
+    if (procedure.variableSlots.find(instruction.destination) != procedure.variableSlots.end() && procedure.variableSlots[instruction.destination] <= 0) {
+        definitions.push_back(procedure.variableSlots[instruction.destination]);
+    }
+}
+
+// Lets locals that are never live at the same time share a frame slot. A slot
+// is live from a write to the reads that can see it, and the slot of a
+// promoted variable is live wherever the variable is, since that is where it
+// goes when spilled. Slots whose address is taken keep one to themselves, and
+// parameters kept in the frame are written on entry before the body runs
+void colorStackSlots(Procedure& procedure) {
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    int length = procedure.blocks.size();
+    set<int> slots;
+    set<int> addressed;
+    map<int, set<int>> interference;
+    vector<set<int>> liveIn(length);
+    vector<set<int>> liveOut(length);
+    vector<int> uses;
+    vector<int> definitions;
+    bool changed = true;
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if ((instruction.opcode == Opcode::LOAD_LOCAL || instruction.opcode == Opcode::STORE_LOCAL || instruction.opcode == Opcode::ADDRESS_LOCAL)
+                && instruction.immediate <= 0) {
+                slots.insert(instruction.immediate);
+            }
+
+            if (instruction.opcode == Opcode::ADDRESS_LOCAL && instruction.immediate <= 0) {
+                addressed.insert(instruction.immediate);
+            }
+        }
+    }
+
+    for (auto& variable : procedure.variableSlots) {
+        if (variable.second <= 0) {
+            slots.insert(variable.second);
+        }
+    }
+
+    for (int parameter : procedure.parameters) {
+        if (parameter <= 0) {
+            slots.insert(parameter);
+        }
+    }
+
+    while (changed) {
+        changed = false;
+
+        for (int i = length - 1; i >= 0; --i) {
+            set<int> live;
+
+            for (int successor : graph.successors.at(i)) {
+                live.insert(liveIn.at(successor).begin(), liveIn.at(successor).end());
+            }
+
+            liveOut.at(i) = live;
+
+            for (int j = procedure.blocks.at(i).instructions.size() - 1; j >= 0; --j) {
+                slotAccesses(procedure, procedure.blocks.at(i).instructions.at(j), uses, definitions);
+
+                for (int slot : definitions) {
+                    live.erase(slot);
+                }
+
+                live.insert(uses.begin(), uses.end());
+            }
+
+            if (live != liveIn.at(i)) {
+                liveIn.at(i) = live;
+                changed = true;
+            }
+        }
+    }
+
+    auto interfere = [&interference](int first, int second) {
+        if (first != second) {
+            interference[first].insert(second);
+            interference[second].insert(first);
+        }
+    };
+
+    for (int i = 0; i < length; ++i) {
+        set<int> live = liveOut.at(i);
+
+        for (int j = procedure.blocks.at(i).instructions.size() - 1; j >= 0; --j) {
+            slotAccesses(procedure, procedure.blocks.at(i).instructions.at(j), uses, definitions);
+
+            for (int slot : definitions) {
+                for (int other : live) {
+                    interfere(slot, other);
+                }
+            }
+
+            for (int slot : definitions) {
+                live.erase(slot);
+            }
+
+            live.insert(uses.begin(), uses.end());
+        }
+    }
+
+    set<int> entry = liveIn.at(0);
+
+    for (int parameter : procedure.parameters) {
+        if (parameter <= 0) {
+            entry.insert(parameter);
+        }
+    }
+
+    for (int first : entry) {
+        for (int second : entry) {
+            interfere(first, second);
+        }
+    }
+
+    for (int slot : addressed) {
+        for (int other : slots) {
+            interfere(slot, other);
+        }
+    }
+
+    // Slots are colored from the top of the frame down, so a procedure without
+    // sharing keeps its layout
+    unordered_map<int, int> colors;
+    int count = 0;
+
+    for (set<int>::reverse_iterator slot = slots.rbegin(); slot != slots.rend(); ++slot) {
+        set<int> taken;
+
+        for (int other : interference[*slot]) {
+            if (colors.find(other) != colors.end()) {
+                taken.insert(colors[other]);
+            }
+        }
+
+        int color = 0;
+
+        while (taken.find(color) != taken.end()) {
+            ++color;
+        }
+
+        colors[*slot] = color;
+        count = max(count, color + 1);
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if ((instruction.opcode == Opcode::LOAD_LOCAL || instruction.opcode == Opcode::STORE_LOCAL || instruction.opcode == Opcode::ADDRESS_LOCAL)
+                && instruction.immediate <= 0) {
+                instruction.immediate = -4 * colors[instruction.immediate];
+            }
+        }
+    }
+
+    for (auto& variable : procedure.variableSlots) {
+        if (variable.second <= 0) {
+            variable.second = -4 * colors[variable.second];
+        }
+    }
+
+    for (int& parameter : procedure.parameters) {
+        if (parameter <= 0) {
+            parameter = -4 * colors[parameter];
+        }
+    }
+
+    procedure.sharedBytes = procedure.frameSize - 4 * count;
+    procedure.frameSize = 4 * count;
+}
+
+// Arguments past this many are pushed, the rest go in $5 and up
+const int REGISTER_ARGUMENTS = 5;
+
+// Parameters that arrive in registers get a slot in the frame instead of one
+// above it, which is only written when the address of the parameter is taken
+// or it is spilled
+void moveRegisterParameters(Procedure& procedure) {
+    unordered_map<int, int> slots;
+
+    for (int i = 0; i < procedure.parameters.size() && i < REGISTER_ARGUMENTS; ++i) {
+        slots[procedure.parameters.at(i)] = -procedure.frameSize;
+        procedure.parameters.at(i) = -procedure.frameSize;
+        procedure.frameSize += 4;
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            if ((instruction.opcode == Opcode::LOAD_LOCAL || instruction.opcode == Opcode::STORE_LOCAL || instruction.opcode == Opcode::ADDRESS_LOCAL)
+                && slots.find(instruction.immediate) != slots.end()) {
+                instruction.immediate = slots[instruction.immediate];
+            }
+        }
+    }
+
+    for (auto& variable : procedure.variableSlots) {
+        if (slots.find(variable.second) != slots.end()) {
+            variable.second = slots[variable.second];
+        }
+    }
+}
+
+// Whether a value that may point into an array can be used this way without
+// the array outliving the call or being reached through anything else. Byte
+// offsets from strength reduction add and subtract pointers directly. The
+// difference of two pointers is an integer that is not followed further, and
+// it can rebuild a pointer into the array anywhere, so it lets the array escape
+bool isContained(Instruction& instruction, int position) {
+    switch (instruction.opcode) {
+        case Opcode::COPY:
+        case Opcode::ADD:
+        case Opcode::SUBTRACT:
+        case Opcode::POINTER_ADD:
+        case Opcode::POINTER_SUBTRACT:
+        case Opcode::LESS_THAN:
+        case Opcode::LESS_EQUAL:
+        case Opcode::GREATER_THAN:
+        case Opcode::GREATER_EQUAL:
+        case Opcode::EQUAL:
+        case Opcode::NOT_EQUAL:
+        case Opcode::BRANCH:
+        case Opcode::LOAD:
+        case Opcode::DELETE:
+            return true;
+        case Opcode::STORE:
+            return position == 0;
+        default:
+            return false;
+    }
+}
+
+// Puts arrays of a constant size in the frame when no pointer into them
+// escapes. Pointers are followed through copies and pointer arithmetic, and
+// one that is stored, passed, returned or may also hold some other pointer
+// lets the array escape. An allocation in a loop also needs its array deleted
+// before it runs again, since every iteration gets the same words. Deletes of
+// the arrays go away, which leaves nothing to free on the way out
+int allocateStackArrays(Procedure& procedure) {
+    unordered_map<int, int> constants = constantRegisters(procedure);
+    ControlFlowGraph graph = buildControlFlowGraph(procedure);
+    vector<set<int>> origins(procedure.registers.size());
+    vector<pair<int, int>> sites;
+    bool changed = true;
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (int j = 0; j < procedure.blocks.at(i).instructions.size(); ++j) {
+            if (procedure.blocks.at(i).instructions.at(j).opcode == Opcode::NEW) {
+                sites.push_back({ i, j });
+            }
+        }
+    }
+
+    if (sites.empty()) {
+        return 0;
+    }
+
+    // Origins are allocation sites, or -1 for pointers from anywhere else
+    for (int k = 0; k < sites.size(); ++k) {
+        origins.at(procedure.blocks.at(sites.at(k).first).instructions.at(sites.at(k).second).destination).insert(k);
+    }
+
+    while (changed) {
+        changed = false;
+
+        for (BasicBlock& block : procedure.blocks) {
+            for (Instruction& instruction : block.instructions) {
+                if (instruction.destination == -1 || procedure.registers.at(instruction.destination) != Type::INTSTAR) {
+                    continue;
+                }
+
+                set<int>& destination = origins.at(instruction.destination);
+                int size = destination.size();
+
+                if (instruction.opcode == Opcode::COPY || instruction.opcode == Opcode::POINTER_ADD || instruction.opcode == Opcode::POINTER_SUBTRACT
+                    || instruction.opcode == Opcode::ADD || instruction.opcode == Opcode::SUBTRACT) {
+                    for (int operand : instruction.operands) {
+                        if (procedure.registers.at(operand) == Type::INTSTAR) {
+                            destination.insert(origins.at(operand).begin(), origins.at(operand).end());
+                        }
+                    }
+                } else if (instruction.opcode != Opcode::CONSTANT && instruction.opcode != Opcode::NEW) {
+                    destination.insert(-1);
+                }
+
+                changed = changed || destination.size() != size;
+            }
+        }
+    }
+
+    vector<bool> isStacked(sites.size(), true);
+
+    for (int k = 0; k < sites.size(); ++k) {
+        Instruction& allocation = procedure.blocks.at(sites.at(k).first).instructions.at(sites.at(k).second);
+        int size = allocation.operands.at(0);
+
+        isStacked.at(k) = constants.find(size) != constants.end() && constants[size] > 0 && constants[size] <= options.stackArrayLimit;
+    }
+
+    for (int value = 0; value < origins.size(); ++value) {
+        if (origins.at(value).size() > 1) {
+            for (int origin : origins.at(value)) {
+                if (origin != -1) {
+                    isStacked.at(origin) = false;
+                }
+            }
+        }
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            for (int i = 0; i < instruction.operands.size(); ++i) {
+                for (int origin : origins.at(instruction.operands.at(i))) {
+                    if (origin != -1 && !isContained(instruction, i)) {
+                        isStacked.at(origin) = false;
+                    }
+                }
+            }
+        }
+    }
+
+    // Whether an array from the site may still be in use, which must not be
+    // the case when the site runs again
+    for (int k = 0; k < sites.size(); ++k) {
+        vector<bool> liveOut(procedure.blocks.size(), false);
+
+        changed = isStacked.at(k);
+
+        while (changed) {
+            changed = false;
+
+            for (int i = 0; i < procedure.blocks.size(); ++i) {
+                bool live = false;
+
+                for (int predecessor : graph.predecessors.at(i)) {
+                    live = live || liveOut.at(predecessor);
+                }
+
+                for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+                    if (instruction.opcode == Opcode::NEW && origins.at(instruction.destination).count(k) > 0) {
+                        isStacked.at(k) = isStacked.at(k) && !live;
+                        live = true;
+                    } else if (instruction.opcode == Opcode::DELETE && origins.at(instruction.operands.at(0)).count(k) > 0) {
+                        live = false;
+                    }
+                }
+
+                if (live != liveOut.at(i)) {
+                    liveOut.at(i) = live;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    int count = 0;
+
+    for (int k = 0; k < sites.size(); ++k) {
+        if (isStacked.at(k)) {
+            Instruction& allocation = procedure.blocks.at(sites.at(k).first).instructions.at(sites.at(k).second);
+            int words = constants[allocation.operands.at(0)];
+
+            allocation = createInstruction(Opcode::ADDRESS_LOCAL, allocation.destination, {}, -procedure.frameSize - 4 * (words - 1));
+            procedure.frameSize += 4 * words;
+            ++count;
+        }
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (int i = 0; i < block.instructions.size(); ++i) {
+            Instruction& instruction = block.instructions.at(i);
+
+            if (instruction.opcode == Opcode::DELETE && origins.at(instruction.operands.at(0)).size() == 1 
+                && *origins.at(instruction.operands.at(0)).begin() != -1 && isStacked.at(*origins.at(instruction.operands.at(0)).begin())) {
+                block.instructions.erase(block.instructions.begin() + i--);
+            }
+        }
+    }
+
+    removeUnusedValues(procedure);
+
+    if (options.report) {
+        cerr << "stack arrays: " << count << " of " << sites.size() << " allocations in " << procedure.name << " moved to the frame" << endl;
+    }
+
+    return count;
+}
+
+// Orders blocks so that the hot side of every branch falls through. After
+// each block comes the successor that ran more often than the block that
+// followed it before, or that block, or failing both the first block left
+void layoutBlocks(Procedure& procedure) {
+    vector<bool> placed(procedure.blocks.size(), false);
+    vector<int> order = { 0 };
+    vector<int> mapping(procedure.blocks.size());
+    vector<BasicBlock> blocks;
+    int moved = 0;
+
+    placed.at(0) = true;
+
+    while (order.size() < procedure.blocks.size()) {
+        int last = order.back();
+        int next = last + 1 < procedure.blocks.size() && !placed.at(last + 1) ? last + 1 : -1;
+
+        for (int successor : successors(procedure.blocks.at(last))) {
+            long long count = procedure.blocks.at(successor).count;
+
+            if (!placed.at(successor) && (next == -1 || (count > procedure.blocks.at(next).count && procedure.blocks.at(next).count >= 0))) {
+                next = successor;
+            }
+        }
+
+        for (int i = 0; next == -1; ++i) {
+            next = placed.at(i) ? -1 : i;
+        }
+
+        placed.at(next) = true;
+        order.push_back(next);
+    }
+
+    for (int i = 0; i < order.size(); ++i) {
+        mapping.at(order.at(i)) = i;
+        blocks.push_back(procedure.blocks.at(order.at(i)));
+        moved += order.at(i) != i;
+    }
+
+    for (BasicBlock& block : blocks) {
+        Instruction& terminator = block.instructions.back();
+
+        if (terminator.target != -1) {
+            terminator.target = mapping.at(terminator.target);
+        }
+
+        if (terminator.alternative != -1) {
+            terminator.alternative = mapping.at(terminator.alternative);
+        }
+    }
+
+    procedure.blocks = blocks;
+
+    if (options.report) {
+        cerr << "block layout: " << moved << " blocks moved in " << procedure.name << endl;
+    }
+}
+
+inline unsigned int hashValue(unsigned int hash, unsigned int value) {
+    return (hash ^ value) * 16777619u;
+}
+
+unsigned int hashName(string name) {
+    unsigned int hash = 2166136261u;
+
+    for (char character : name) {
+        hash = hashValue(hash, character);
+    }
+
+    return hash;
+}
+
+// Hashes that name the blocks of a procedure in a profile, from the opcodes,
+// constants and callees in the block and how many blocks before it share
+// them. Registers and targets are left out, so edits elsewhere in the
+// procedure keep the hashes of the blocks they do not touch
+vector<int> blockHashes(Procedure& procedure) {
+    unordered_map<unsigned int, int> occurrences;
+    vector<int> hashes;
+
+    for (BasicBlock& block : procedure.blocks) {
+        unsigned int hash = 2166136261u;
+
+        for (Instruction& instruction : block.instructions) {
+            hash = hashValue(hashValue(hash, instruction.opcode), instruction.immediate);
+            hash = instruction.opcode == Opcode::CALL ? hashValue(hash, hashName(instruction.symbol)) : hash;
+        }
+
+        hashes.push_back(hashValue(hash, occurrences[hash]++));
+    }
+
+    return hashes;
+}
+
+// Gives the blocks of each procedure their counts from the profile
+void annotateProcedures(vector<Procedure>& procedures) {
+    int matched = 0;
+    int total = 0;
+
+    for (Procedure& procedure : procedures) {
+        vector<int> hashes = blockHashes(procedure);
+        int name = hashName(procedure.name);
+
+        for (int i = 0; i < procedure.blocks.size(); ++i) {
+            auto count = profileCounts.find(profileKey(name, hashes.at(i)));
+
+            if (count != profileCounts.end()) {
+                procedure.blocks.at(i).count = count->second;
+                ++matched;
+            }
+        }
+
+        total += procedure.blocks.size();
+    }
+
+    if (options.report) {
+        cerr << "profile: " << matched << " of " << total << " blocks matched in " << options.profileUse << endl;
+    }
+}
+
+// Counters go in a table at the end of the program, three words each, so the
+// offset of the last one has to fit in a load
+const int PROFILE_COUNTERS = 2730;
+const string PROFILE_TABLE = "Pcounts";
+const string PROFILE_DUMP = "Pdump";
+
+// Procedure and block hash of each counter
+vector<pair<int, int>> profileCounters;
+
+// Starts every block with an increment of its own counter
+void instrumentProcedures(vector<Procedure>& procedures) {
+    for (Procedure& procedure : procedures) {
+        vector<int> hashes = blockHashes(procedure);
+
+        for (int i = 0; i < procedure.blocks.size() && profileCounters.size() < PROFILE_COUNTERS; ++i) {
+            vector<Instruction>& instructions = procedure.blocks.at(i).instructions;
+
+            instructions.insert(instructions.begin(), createInstruction(Opcode::PROFILE, -1, {}, profileCounters.size()));
+            profileCounters.push_back({ hashName(procedure.name), hashes.at(i) });
+        }
+    }
+
+    if (options.report) {
+        cerr << "profile: " << profileCounters.size() << " blocks instrumented" << endl;
+    }
+}
+
+// Procedures are optimized in declaration order, callees before callers
+void optimize(vector<Procedure>& procedures) {
+    if (!options.profileUse.empty()) {
+        annotateProcedures(procedures);
+    }
+
+    if (options.profileGenerate) {
+        instrumentProcedures(procedures);
+    }
+
+    if (options.specialization && options.constantPropagation) {
+        specializeProcedures(procedures);
+    }
+
+    for (int i = 0; i < procedures.size(); ++i) {
+        Procedure& procedure = procedures.at(i);
+
+        if (options.registerVariables) {
+            promoteVariables(procedure);
+        }
+
+        // Procedures that never ran in the profile are not worth growing
+        if (options.inlining && options.registerExpressions && procedure.blocks.at(0).count != 0) {
+            inlineCalls(procedures, i);
+        }
+
+        if (options.tailCalls && options.registerExpressions) {
+            eliminateTailRecursion(procedure);
+        }
+
+        if (options.ifConversion && options.registerExpressions) {
+            convertBranches(procedure);
+        }
+
+        if (options.constantPropagation) {
+            propagateConstants(procedure);
+        }
+
+        if (options.commonSubexpressions && options.registerExpressions) {
+            eliminateCommonSubexpressions(procedure);
+        }
+
+        if (options.loopInvariants && options.registerExpressions) {
+            moveLoopInvariants(procedure);
+        }
+
+        if (options.inductionVariables && options.registerExpressions) {
+            optimizeInductionVariables(procedure);
+        }
+
+        // The stack emitter needs temporaries used once and in order, which
+        // addition chains do not keep
+        if (options.strengthReduction && options.registerExpressions) {
+            reduceStrength(procedure);
+        }
+
+        if (options.deadCodeElimination) {
+            eliminateDeadCode(procedure);
+        }
+    }
+
+    // Unrolled bodies would no longer fit the inlining limits of their callers
+    for (Procedure& procedure : procedures) {
+        if (options.unrollLoops && options.registerExpressions && procedure.blocks.at(0).count != 0) {
+            unrollLoops(procedure);
+        }
+
+        if (options.deadCodeElimination) {
+            eliminateDeadCode(procedure);
+        }
+    }
+
+    // Callers inline the bodies of earlier procedures, so branches test plain
+    // conditions until every procedure has been optimized
+    vector<int> counts(SELECTION_PATTERNS.size(), 0);
+
+    for (Procedure& procedure : procedures) {
+        if (options.fusedBranches) {
+            fuseBranches(procedure);
+        }
+
+        if (options.instructionSelection && options.registerExpressions) {
+            selectInstructions(procedure, counts);
+        }
+
+        if (options.registerArguments && options.registerExpressions && !procedure.isMain) {
+            moveRegisterParameters(procedure);
+        }
+
+        if (options.stackSlotColoring) {
+            colorStackSlots(procedure);
+        }
+
+        // Arrays go below the colored slots, which only hold single words
+        if (options.stackArrays && options.registerExpressions) {
+            allocateStackArrays(procedure);
+        }
+
+        if (!options.profileUse.empty()) {
+            layoutBlocks(procedure);
+        }
+    }
+
+    if (options.report && options.instructionSelection && options.registerExpressions) {
+        for (int i = 0; i < SELECTION_PATTERNS.size(); ++i) {
+            cerr << "instruction selection " << SELECTION_PATTERNS.at(i).first << ": " << counts.at(i) << endl;
+        }
+    }
+}
+
+const vector<string> SCRATCH_REGISTERS = { "$12", "$10" };
+
+// State of the procedure being emitted. Leaf procedures address their frame
+// from $30 and leave $29 to the caller, and procedures that keep $31 in their
+// frame make calls without pushing it
+string frameRegister = "$29";
+int frameBias = 0;
+bool linkSaved = false;
+unordered_set<string> leafProcedures;
+
+inline string frameOffset(int offset) {
+    return to_string(offset + frameBias);
+}
+
+// Procedures other than wain that never call anything, including the runtime
+bool makesCalls(Procedure& procedure) {
+    // An instrumented wain prints the counters before it returns
+    if (procedure.isMain && options.profileGenerate) {
+        return true;
+    }
+
+    for (BasicBlock& block : procedure.blocks) {
+        for (Instruction& instruction : block.instructions) {
+            Opcode opcode = instruction.opcode;
+
+            if (opcode == Opcode::CALL || opcode == Opcode::PRINT || opcode == Opcode::NEW || opcode == Opcode::DELETE) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool isLeaf(Procedure& procedure) {
+    return !procedure.isMain && !makesCalls(procedure);
+}
+
+inline string compareInstruction(bool isUnsigned, string registerOne, string registerTwo, string registerThree) {
+    return isUnsigned ? setLessThanUnsignedInstruction(registerOne, registerTwo, registerThree) : setLessThanInstruction(registerOne, registerTwo, registerThree);
+}
+
+string callRuntime(string routine) {
+    if (linkSaved) {
+        return loadSkipInstruction("$10", routine) + jumpLinkInstruction("$10");
+    }
+
+    return pushInstruction("$31") + loadSkipInstruction("$10", routine) + jumpLinkInstruction("$10") + popInstruction("$31");
+}
+
+// Emits a fused compare and branch. Equality is tested by the branch itself,
+// the other comparisons leave their outcome in a scratch register for the
+// branch to test against zero
+string emitBranch(Instruction& instruction, Procedure& procedure, string first, string second, int next) {
+    string partialCode = "";
+    Opcode comparison = instruction.comparison;
+    bool onEqual = comparison == Opcode::EQUAL;
+
+    if (comparison != Opcode::EQUAL && comparison != Opcode::NOT_EQUAL) {
+        bool isSwapped = comparison == Opcode::GREATER_THAN || comparison == Opcode::LESS_EQUAL;
+
+        partialCode += compareInstruction(instruction.isUnsigned, SCRATCH_REGISTERS.at(0), isSwapped ? second : first, isSwapped ? first : second);
+        first = SCRATCH_REGISTERS.at(0);
+        second = "$0";
+        onEqual = comparison == Opcode::GREATER_EQUAL || comparison == Opcode::LESS_EQUAL;
+    }
+
+    string target = procedure.blocks.at(instruction.target).label;
+    string alternative = procedure.blocks.at(instruction.alternative).label;
+
+    if (instruction.target == next) {
+        partialCode += onEqual ? branchNotEqualInstruction(first, second, alternative) : branchEqualInstruction(first, second, alternative);
+    } else {
+        partialCode += onEqual ? branchEqualInstruction(first, second, target) : branchNotEqualInstruction(first, second, target);
+
+        if (instruction.alternative != next) {
+            partialCode += branchEqualInstruction("$0", "$0", alternative);
+        }
+    }
+
+    return partialCode;
+}
+
+// Emits every instruction other than a call, reading operands from and writing
+// the result to the given registers. The result may share a register with an
+// operand, so every sequence reads its operands before overwriting the result
+string emitOperation(Instruction& instruction, Procedure& procedure, vector<string>& operands, string result, int next) {
+    string partialCode = "";
+
+    switch (instruction.opcode) {
+        case Opcode::CONSTANT:
+            if (result == constantRegister(instruction.immediate)) {
+                break;
+            } else if (procedure.registers.at(instruction.destination) == Type::INTSTAR && instruction.immediate == 1) {
+                partialCode += addInstruction(result, "$0", "$11");
+            } else {
+                partialCode += loadSkipInstruction(result, to_string(instruction.immediate));
+            }
+            break;
+
+        case Opcode::COPY:
+            if (result != operands.at(0)) {
+                partialCode += addInstruction(result, operands.at(0), "$0");
+            }
+            break;
+
+        case Opcode::ADD:
+            partialCode += addInstruction(result, operands.at(0), operands.at(1));
+            break;
+
+        case Opcode::SUBTRACT:
+            partialCode += subtractInstruction(result, operands.at(0), operands.at(1));
+            break;
+
+        case Opcode::MULTIPLY:
+            partialCode += multiplyInstruction(operands.at(0), operands.at(1));
+            partialCode += moveLowInstruction(result);
+            break;
+
+        case Opcode::DIVIDE:
+        case Opcode::MODULO:
+            partialCode += divideInstruction(operands.at(0), operands.at(1));
+            partialCode += instruction.opcode == Opcode::DIVIDE ? moveLowInstruction(result) : moveHighInstruction(result);
+            break;
+
+        case Opcode::POINTER_ADD:
+        case Opcode::POINTER_SUBTRACT: {
+            string scaled = result;
+
+            if (operands.size() == 1 || result == operands.at(0)) {
+                scaled = operands.back() == SCRATCH_REGISTERS.at(0) ? SCRATCH_REGISTERS.at(1) : SCRATCH_REGISTERS.at(0);
+            }
+
+            if (operands.size() == 1 && constantRegister(4 * instruction.immediate) != "") {
+                scaled = constantRegister(4 * instruction.immediate);
+            } else if (operands.size() == 1) {
+                partialCode += loadSkipInstruction(scaled, to_string(4 * instruction.immediate));
+            } else if (options.strengthReduction) {
+                partialCode += addInstruction(scaled, operands.at(1), operands.at(1));
+                partialCode += addInstruction(scaled, scaled, scaled);
+                ++removedMultiplications;
+            } else {
+                partialCode += multiplyInstruction(operands.at(1), "$4");
+                partialCode += moveLowInstruction(scaled);
+            }
+            partialCode += instruction.opcode == Opcode::POINTER_ADD 
+                ? addInstruction(result, operands.at(0), scaled) 
+                : subtractInstruction(result, operands.at(0), scaled);
+            break;
+        }
+
+        case Opcode::POINTER_DIFFERENCE:
+            partialCode += subtractInstruction(result, operands.at(0), operands.at(1));
+            partialCode += divideInstruction(result, "$4");
+            partialCode += moveLowInstruction(result);
+            break;
+
+        case Opcode::LESS_THAN:
+        case Opcode::GREATER_EQUAL:
+            partialCode += compareInstruction(instruction.isUnsigned, result, operands.at(0), operands.at(1));
+
+            if (instruction.opcode == Opcode::GREATER_EQUAL) {
+                partialCode += subtractInstruction(result, "$11", result);
+            }
+            break;
+
+        case Opcode::GREATER_THAN:
+        case Opcode::LESS_EQUAL:
+            partialCode += compareInstruction(instruction.isUnsigned, result, operands.at(1), operands.at(0));
+
+            if (instruction.opcode == Opcode::LESS_EQUAL) {
+                partialCode += subtractInstruction(result, "$11", result);
+            }
+            break;
+
+        case Opcode::EQUAL:
+        case Opcode::NOT_EQUAL:
+            partialCode += subtractInstruction(result, operands.at(0), operands.at(1));
+            partialCode += setLessThanUnsignedInstruction(result, "$0", result);
+
+            if (instruction.opcode == Opcode::EQUAL) {
+                partialCode += subtractInstruction(result, "$11", result);
+            }
+            break;
+
+        case Opcode::LOAD_LOCAL:
+            partialCode += loadInstruction(result, frameOffset(instruction.immediate), frameRegister);
+            break;
+
+        case Opcode::STORE_LOCAL:
+            partialCode += saveInstruction(operands.at(0), frameOffset(instruction.immediate), frameRegister);
+            break;
+
+        case Opcode::ADDRESS_LOCAL:
+            partialCode += loadSkipInstruction(result, frameOffset(instruction.immediate));
+            partialCode += addInstruction(result, result, frameRegister);
+            break;
+
+        case Opcode::LOAD:
+            partialCode += loadInstruction(result, to_string(instruction.immediate), operands.at(0));
+            break;
+
+        case Opcode::STORE:
+            partialCode += saveInstruction(operands.at(1), to_string(instruction.immediate), operands.at(0));
+            break;
+
+        case Opcode::NEW:
+            partialCode += addInstruction("$1", "$0", operands.at(0));
+            partialCode += callRuntime("new");
+            partialCode += branchNotEqualInstruction("$3", "$0", "1");
+            partialCode += addInstruction("$3", "$0", "$11");
+
+            if (result != "$3") {
+                partialCode += addInstruction(result, "$3", "$0");
+            }
+            break;
+
+        case Opcode::DELETE: {
+            string label = generateLabel();
+
+            partialCode += branchEqualInstruction(operands.at(0), "$11", label);
+            partialCode += addInstruction("$1", "$0", operands.at(0));
+            partialCode += callRuntime("delete");
+            partialCode += labelInstruction(label);
+            break;
+        }
+
+        case Opcode::PRINT:
+            if (!printIncluded) {
+                partialCode += importInstruction("print");
+                printIncluded = true;
+            }
+
+            partialCode += addInstruction("$1", operands.at(0), "$0");
+            partialCode += callRuntime("print");
+            break;
+
+        case Opcode::PROFILE:
+            partialCode += loadSkipInstruction(SCRATCH_REGISTERS.at(0), PROFILE_TABLE);
+            partialCode += loadInstruction(SCRATCH_REGISTERS.at(1), to_string(12 * instruction.immediate + 8), SCRATCH_REGISTERS.at(0));
+            partialCode += addInstruction(SCRATCH_REGISTERS.at(1), SCRATCH_REGISTERS.at(1), "$11");
+            partialCode += saveInstruction(SCRATCH_REGISTERS.at(1), to_string(12 * instruction.immediate + 8), SCRATCH_REGISTERS.at(0));
+            break;
+
+        case Opcode::JUMP:
+            if (instruction.target != next) {
+                partialCode += branchEqualInstruction("$0", "$0", procedure.blocks.at(instruction.target).label);
+            }
+            break;
+
+        case Opcode::BRANCH:
+            partialCode += emitBranch(instruction, procedure, operands.at(0), operands.size() == 2 ? operands.at(1) : constantRegister(instruction.immediate), next);
+            break;
+
+        case Opcode::RETURN:
+            if (operands.at(0) != "$3") {
+                partialCode += addInstruction("$3", operands.at(0), "$0");
+            }
+
+            if (procedure.isMain && options.profileGenerate) {
+                partialCode += callRuntime(PROFILE_DUMP);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return partialCode;
+}
+
+// Saves are stored right after the frame is set up, before wain calls init
+string emitPrologue(Procedure& procedure, int frameSize, string saves = "") {
+    string partialCode = "";
+
+    if (procedure.isMain) {
+        partialCode += loadSkipInstruction("$4", "4");
+        partialCode += loadSkipInstruction("$11", "1");
+    } else {
+        partialCode += labelInstruction(generateFunction(procedure.name));
+    }
+
+    if (frameRegister == "$29") {
+        partialCode += subtractInstruction("$29", "$30", "$4");
+    }
+
+    if (frameRegister == "$29" || frameSize > 0) {
+        partialCode += loadSkipInstruction("$12", to_string(frameSize));
+        partialCode += subtractInstruction("$30", "$30", "$12");
+    }
+
+    partialCode += saves;
+
+    if (procedure.isMain) {
+        partialCode += saveInstruction("$1", to_string(procedure.parameters.at(0)), "$29");
+        partialCode += saveInstruction("$2", to_string(procedure.parameters.at(1)), "$29");
+
+        if (heapIncluded) {
+            if (procedure.parameterTypes.at(0) == Type::INT) {
+                partialCode += loadSkipInstruction("$2", "0");
+            }
+
+            partialCode += importInstruction("init");
+            partialCode += importInstruction("new");
+            partialCode += importInstruction("delete");
+            partialCode += callRuntime("init");
+        }
+    }
+
+    return partialCode;
+}
+
+string emitEpilogue(int frameSize = 0) {
+    if (frameRegister != "$29" && frameSize == 0) {
+        return jumpInstruction("$31");
+    } else if (frameRegister != "$29") {
+        return loadSkipInstruction("$12", to_string(frameSize)) + addInstruction("$30", "$30", "$12") + jumpInstruction("$31");
+    }
+
+    return addInstruction("$30", "$29", "$4") + jumpInstruction("$31");
+}
+
+// Keeps the most recent value in $3 and every older one on the stack, which
+// reproduces the push and pop discipline of expression trees
+struct TemporaryStack {
+    int accumulator = -1;
+    vector<int> values;
+    unordered_set<int> argumentHeads;
+
+    string spill() {
+        string partialCode = "";
+
+        if (accumulator != -1) {
+            if (argumentHeads.find(accumulator) != argumentHeads.end()) {
+                partialCode += pushInstruction("$29");
+                partialCode += pushInstruction("$31");
+            }
+
+            partialCode += pushInstruction("$3");
+            values.push_back(accumulator);
+            accumulator = -1;
+        }
+
+        return partialCode;
+    }
+
+    string fetch(vector<int>& operands, vector<string>& locations) {
+        string partialCode = "";
+        int pending = 0;
+
+        if (accumulator != -1 && find(operands.begin(), operands.end(), accumulator) == operands.end()) {
+            partialCode += spill();
+        }
+
+        locations.assign(operands.size(), "$3");
+
+        for (int i = 0; i < operands.size(); ++i) {
+            if (operands.at(i) != accumulator) {
+                ++pending;
+            }
+        }
+
+        for (int scratch = 5; pending --> 0; ++scratch) {
+            string location = "$" + to_string(scratch);
+
+            for (int i = 0; i < operands.size(); ++i) {
+                if (operands.at(i) == values.back()) {
+                    locations.at(i) = location;
+                }
+            }
+
+            partialCode += popInstruction(location);
+            values.pop_back();
+        }
+
+        accumulator = -1;
+
+        return partialCode;
+    }
+
+    string call(Instruction& instruction) {
+        string partialCode = "";
+        vector<int>& arguments = instruction.operands;
+
+        if (arguments.empty()) {
+            partialCode += spill();
+            partialCode += pushInstruction("$29");
+            partialCode += pushInstruction("$31");
+        } else if (accumulator == arguments.back()) {
+            partialCode += spill();
+        }
+
+        values.resize(values.size() - arguments.size());
+
+        partialCode += loadSkipInstruction("$10", generateFunction(instruction.symbol));
+        partialCode += jumpLinkInstruction("$10");
+
+        if (!arguments.empty()) {
+            partialCode += loadSkipInstruction("$12", to_string(4 * arguments.size()));
+            partialCode += addInstruction("$30", "$30", "$12");
+        }
+
+        partialCode += popInstruction("$31");
+        partialCode += popInstruction("$29");
+        accumulator = instruction.destination;
+
+        return partialCode;
+    }
+};
+
+string emitStackProcedure(Procedure& procedure) {
+    string partialCode = emitPrologue(procedure, procedure.frameSize);
+    TemporaryStack stack;
+
+    if (options.report && options.stackSlotColoring) {
+        cerr << "stack slots: frame of " << procedure.name << " takes " << procedure.frameSize << " bytes instead of " 
+            << procedure.frameSize + procedure.sharedBytes << endl;
+    }
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            if (instruction.opcode == Opcode::CALL && !instruction.operands.empty()) {
+                stack.argumentHeads.insert(instruction.operands.at(0));
+            }
+        }
+    }
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        if (i > 0) {
+            partialCode += labelInstruction(procedure.blocks.at(i).label);
+        }
+
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            if (instruction.opcode == Opcode::CALL) {
+                partialCode += stack.call(instruction);
+                continue;
+            }
+
+            vector<string> locations;
+
+            partialCode += stack.fetch(instruction.operands, locations);
+            partialCode += emitOperation(instruction, procedure, locations, "$3", i + 1);
+
+            if (instruction.opcode == Opcode::RETURN) {
+                partialCode += emitEpilogue();
+            }
+
+            if (instruction.destination != -1) {
+                stack.accumulator = instruction.destination;
+            }
+        }
+    }
+
+    return partialCode;
+}
+
+// Registers that hold virtual registers, the rest are reserved for constants,
+// the frame, calls and scratch values. Procedures preserve the callee saved
+// ones they use, and the runtime routines preserve every register but $3
+const vector<string> ALLOCATABLE_REGISTERS = {
+    "$5", "$6", "$7", "$8", "$9", "$13", "$14", "$15", "$16", "$17", "$18", 
+    "$19", "$20", "$21", "$22", "$23", "$24", "$25", "$26", "$27", "$28"
+};
+
+const int FIRST_CALLEE_SAVED = 5;
+
+// The caller saved registers double as argument registers, so the argument at
+// an index is passed in the allocatable register at the same index
+const vector<string> ARGUMENT_REGISTERS = { "$5", "$6", "$7", "$8", "$9" };
+
+// The loads at the start of a procedure taking arguments in registers, as the
+// variable loaded and the index of its argument
+vector<pair<int, int>> argumentLoads(Procedure& procedure) {
+    vector<pair<int, int>> loads;
+    int count = min((int)procedure.parameters.size(), REGISTER_ARGUMENTS);
+
+    if (!options.registerArguments || procedure.isMain) {
+        return loads;
+    }
+
+    for (Instruction& instruction : procedure.blocks.at(0).instructions) {
+        int index = find(procedure.parameters.begin(), procedure.parameters.begin() + count, instruction.immediate) - procedure.parameters.begin();
+
+        if (instruction.opcode != Opcode::LOAD_LOCAL || index == count) {
+            break;
+        }
+
+        loads.push_back({ instruction.destination, index });
+    }
+
+    return loads;
+}
+
+struct Allocation {
+    vector<string> locations;
+    vector<int> slots;
+    int frameSize;
+    vector<string> saved;
+};
+
+// Linear scan over the live interval of every virtual register. Intervals
+// live across a call only take callee saved registers, and when registers
+// run out the interval that ends last moves to a frame slot, which it shares
+// with earlier spills whose intervals do not overlap its own
+Allocation allocateRegisters(Procedure& procedure) {
+    Allocation allocation;
+    Liveness liveness = computeLiveness(procedure);
+    int count = procedure.registers.size();
+    int position = 0;
+    vector<int> start(count, -1);
+    vector<int> end(count, -1);
+    vector<int> calls;
+
+    auto extend = [&start, &end](int value, int position) {
+        start.at(value) = start.at(value) == -1 ? position : min(start.at(value), position);
+        end.at(value) = max(end.at(value), position);
+    };
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        for (int value : liveness.liveIn.at(i)) {
+            extend(value, position);
+        }
+
+        for (Instruction& instruction : procedure.blocks.at(i).instructions) {
+            for (int operand : instruction.operands) {
+                extend(operand, position);
+            }
+
+            if (instruction.destination != -1) {
+                extend(instruction.destination, position);
+            }
+
+            if (instruction.opcode == Opcode::CALL) {
+                calls.push_back(position);
+            }
+
+            ++position;
+        }
+
+        for (int value : liveness.liveOut.at(i)) {
+            extend(value, position - 1);
+        }
+    }
+
+    vector<int> order;
+    vector<int> active;
+    vector<bool> crossesCall(count, false);
+    set<int> available;
+    unordered_map<int, string> fixed;
+
+    // Constants kept in $0, $11 and $4 are read from there
+    if (options.instructionSelection) {
+        for (auto& constant : constantRegisters(procedure)) {
+            if (constantRegister(constant.second) != "") {
+                fixed[constant.first] = constantRegister(constant.second);
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (start.at(i) != -1 && fixed.find(i) == fixed.end()) {
+            order.push_back(i);
+
+            for (int call : calls) {
+                crossesCall.at(i) = crossesCall.at(i) || (start.at(i) < call && end.at(i) > call);
+            }
+        }
+    }
+
+    for (int i = 0; i < ALLOCATABLE_REGISTERS.size(); ++i) {
+        available.insert(i);
+    }
+
+    sort(order.begin(), order.end(), [&start](int first, int second) { return start.at(first) < start.at(second); });
+
+    // Parameters stay in the register they arrive in when it is free
+    unordered_map<int, int> preferred;
+
+    for (pair<int, int> load : argumentLoads(procedure)) {
+        preferred[load.first] = load.second;
+    }
+
+    vector<int> assigned(count, -1);
+    vector<vector<int>> spillSlots;
+    int spills = 0;
+
+    allocation.locations.assign(count, "");
+    allocation.slots.assign(count, 0);
+    allocation.frameSize = procedure.frameSize;
+
+    for (int current : order) {
+        for (int i = 0; i < active.size(); ++i) {
+            if (end.at(active.at(i)) < start.at(current)) {
+                available.insert(assigned.at(active.at(i)));
+                active.erase(active.begin() + i--);
+            }
+        }
+
+        int lowest = crossesCall.at(current) ? FIRST_CALLEE_SAVED : 0;
+        set<int>::iterator free = available.lower_bound(lowest);
+        int spilled = current;
+
+        if (preferred.find(current) != preferred.end() && preferred[current] >= lowest && available.find(preferred[current]) != available.end()) {
+            free = available.find(preferred[current]);
+        }
+
+        if (free != available.end()) {
+            assigned.at(current) = *free;
+            available.erase(free);
+            active.push_back(current);
+            continue;
+        }
+
+        for (int candidate : active) {
+            if (assigned.at(candidate) >= lowest && end.at(candidate) > end.at(spilled)) {
+                spilled = candidate;
+            }
+        }
+
+        if (spilled != current) {
+            assigned.at(current) = assigned.at(spilled);
+            assigned.at(spilled) = -1;
+            active.erase(find(active.begin(), active.end(), spilled));
+            active.push_back(current);
+        }
+
+        if (procedure.variableSlots.find(spilled) != procedure.variableSlots.end()) {
+            allocation.slots.at(spilled) = procedure.variableSlots[spilled];
+            continue;
+        }
+
+        int slot = options.stackSlotColoring ? 0 : spillSlots.size();
+
+        while (slot < spillSlots.size() && any_of(spillSlots.at(slot).begin(), spillSlots.at(slot).end(), 
+            [&start, &end, spilled](int other) { return start.at(other) <= end.at(spilled) && start.at(spilled) <= end.at(other); })) {
+            ++slot;
+        }
+
+        if (slot == spillSlots.size()) {
+            spillSlots.push_back({});
+            allocation.frameSize += 4;
+        }
+
+        spillSlots.at(slot).push_back(spilled);
+        allocation.slots.at(spilled) = -procedure.frameSize - 4 * slot;
+        ++spills;
+    }
+
+    set<int> used;
+
+    for (auto& constant : fixed) {
+        allocation.locations.at(constant.first) = constant.second;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (assigned.at(i) != -1) {
+            allocation.locations.at(i) = ALLOCATABLE_REGISTERS.at(assigned.at(i));
+
+            if (assigned.at(i) >= FIRST_CALLEE_SAVED && !procedure.isMain) {
+                used.insert(assigned.at(i));
+            }
+        }
+    }
+
+    for (int index : used) {
+        allocation.saved.push_back(ALLOCATABLE_REGISTERS.at(index));
+    }
+
+    // Procedures that call keep their return address in the frame rather than
+    // pushing it around every call
+    if (options.leafProcedures && (makesCalls(procedure) || (procedure.isMain && heapIncluded))) {
+        allocation.saved.push_back("$31");
+    }
+
+    allocation.frameSize += 4 * allocation.saved.size();
+
+    if (options.report && options.stackSlotColoring) {
+        cerr << "stack slots: frame of " << procedure.name << " takes " << allocation.frameSize << " bytes instead of " 
+            << allocation.frameSize + procedure.sharedBytes + 4 * (spills - spillSlots.size()) << endl;
+    }
+
+    return allocation;
+}
+
+// Copies between registers as if all at once, breaking cycles through the
+// scratch register. Moves are pairs of destination and source
+string emitParallelMoves(vector<pair<string, string>> moves) {
+    string partialCode = "";
+
+    moves.erase(remove_if(moves.begin(), moves.end(), [](pair<string, string>& move) { return move.first == move.second; }), moves.end());
+
+    while (!moves.empty()) {
+        int ready = -1;
+
+        for (int i = 0; i < moves.size() && ready == -1; ++i) {
+            bool isRead = false;
+
+            for (int j = 0; j < moves.size(); ++j) {
+                isRead = isRead || (j != i && moves.at(j).second == moves.at(i).first);
+            }
+
+            ready = isRead ? -1 : i;
+        }
+
+        if (ready == -1) {
+            string blocked = moves.at(0).first;
+            partialCode += addInstruction(SCRATCH_REGISTERS.at(0), blocked, "$0");
+
+            for (pair<string, string>& move : moves) {
+                move.second = move.second == blocked ? SCRATCH_REGISTERS.at(0) : move.second;
+            }
+
+            continue;
+        }
+
+        partialCode += addInstruction(moves.at(ready).first, moves.at(ready).second, "$0");
+        moves.erase(moves.begin() + ready);
+    }
+
+    return partialCode;
+}
+
+// Puts the leading arguments of a call in the argument registers
+string emitArgumentMoves(vector<int>& arguments, int count, Allocation& allocation) {
+    vector<pair<string, string>> moves;
+    string loads = "";
+
+    for (int i = 0; i < count; ++i) {
+        if (allocation.locations.at(arguments.at(i)) != "") {
+            moves.push_back({ ARGUMENT_REGISTERS.at(i), allocation.locations.at(arguments.at(i)) });
+        } else {
+            loads += loadInstruction(ARGUMENT_REGISTERS.at(i), frameOffset(allocation.slots.at(arguments.at(i))), frameRegister);
+        }
+    }
+
+    return emitParallelMoves(moves) + loads;
+}
+
+string emitCall(Instruction& instruction, Allocation& allocation) {
+    string partialCode = "";
+    bool savesFrame = leafProcedures.find(instruction.symbol) == leafProcedures.end();
+
+    if (savesFrame) {
+        partialCode += pushInstruction("$29");
+    }
+
+    if (!linkSaved) {
+        partialCode += pushInstruction("$31");
+    }
+
+    vector<int>& arguments = instruction.operands;
+    int registers = options.registerArguments ? min((int)arguments.size(), REGISTER_ARGUMENTS) : 0;
+
+    for (int i = registers; i < arguments.size(); ++i) {
+        if (allocation.locations.at(arguments.at(i)) != "") {
+            partialCode += pushInstruction(allocation.locations.at(arguments.at(i)));
+        } else {
+            partialCode += loadInstruction(SCRATCH_REGISTERS.at(0), frameOffset(allocation.slots.at(arguments.at(i))), frameRegister);
+            partialCode += pushInstruction(SCRATCH_REGISTERS.at(0));
+        }
+    }
+
+    partialCode += emitArgumentMoves(arguments, registers, allocation);
+    partialCode += loadSkipInstruction("$10", generateFunction(instruction.symbol));
+    partialCode += jumpLinkInstruction("$10");
+
+    if (arguments.size() > registers) {
+        partialCode += loadSkipInstruction("$12", to_string(4 * (arguments.size() - registers)));
+        partialCode += addInstruction("$30", "$30", "$12");
+    }
+
+    if (!linkSaved) {
+        partialCode += popInstruction("$31");
+    }
+
+    if (savesFrame) {
+        partialCode += popInstruction("$29");
+    }
+
+    return partialCode;
+}
+
+inline int savedSlot(Allocation& allocation, int index) {
+    return 4 * (index + 1) - allocation.frameSize;
+}
+
+string emitRestores(Allocation& allocation) {
+    string partialCode = "";
+
+    for (int i = 0; i < allocation.saved.size(); ++i) {
+        partialCode += loadInstruction(allocation.saved.at(i), frameOffset(savedSlot(allocation, i)), frameRegister);
+    }
+
+    return partialCode;
+}
+
+// Calls a procedure taking as many arguments in place of returning its result.
+// The arguments overwrite our own above the frame or in the argument
+// registers, the frame is torn down and the callee returns straight to our
+// caller. Arguments go through the stack first when one of them is spilled to
+// a parameter slot
+string emitTailCall(Instruction& instruction, Procedure& procedure, Allocation& allocation) {
+    string partialCode = "";
+    vector<int>& arguments = instruction.operands;
+    int registers = options.registerArguments ? min((int)arguments.size(), REGISTER_ARGUMENTS) : 0;
+    bool isStaged = false;
+
+    for (int argument : arguments) {
+        isStaged = isStaged || (allocation.locations.at(argument) == "" 
+            && find(procedure.parameters.begin(), procedure.parameters.end(), allocation.slots.at(argument)) != procedure.parameters.end());
+    }
+
+    for (int i = isStaged ? 0 : registers; i < arguments.size(); ++i) {
+        string location = allocation.locations.at(arguments.at(i));
+
+        if (location == "") {
+            location = SCRATCH_REGISTERS.at(0);
+            partialCode += loadInstruction(location, frameOffset(allocation.slots.at(arguments.at(i))), frameRegister);
+        }
+
+        partialCode += isStaged ? pushInstruction(location) : saveInstruction(location, frameOffset(procedure.parameters.at(i)), frameRegister);
+    }
+
+    for (int i = 0; isStaged && i < arguments.size(); ++i) {
+        string location = i < registers ? ARGUMENT_REGISTERS.at(i) : SCRATCH_REGISTERS.at(0);
+
+        partialCode += loadInstruction(location, to_string(4 * (arguments.size() - 1 - i)), "$30");
+
+        if (i >= registers) {
+            partialCode += saveInstruction(location, frameOffset(procedure.parameters.at(i)), frameRegister);
+        }
+    }
+
+    if (!isStaged) {
+        partialCode += emitArgumentMoves(arguments, registers, allocation);
+    }
+
+    partialCode += emitRestores(allocation);
+    partialCode += addInstruction("$30", "$29", "$4");
+    partialCode += loadSkipInstruction("$10", generateFunction(instruction.symbol));
+    partialCode += jumpInstruction("$10");
+
+    return partialCode;
+}
+
+string emitRegisterProcedure(Procedure& procedure) {
+    string partialCode = "";
+    Allocation allocation = allocateRegisters(procedure);
+    bool isLeafProcedure = leafProcedures.find(procedure.name) != leafProcedures.end();
+
+    frameRegister = isLeafProcedure ? "$30" : "$29";
+    frameBias = isLeafProcedure ? allocation.frameSize - 4 : 0;
+    linkSaved = options.leafProcedures && !isLeafProcedure;
+
+    // Arguments that arrive in registers are moved to where their parameters
+    // live, and written to the frame first when the slot is read there
+    vector<pair<int, int>> loads = argumentLoads(procedure);
+    vector<pair<string, string>> moves;
+
+    for (int i = 0; !procedure.isMain && options.registerArguments && i < procedure.parameters.size() && i < REGISTER_ARGUMENTS; ++i) {
+        bool isRead = false;
+
+        for (int j = 0; j < procedure.blocks.size(); ++j) {
+            for (int position = j == 0 ? loads.size() : 0; position < procedure.blocks.at(j).instructions.size(); ++position) {
+                Instruction& instruction = procedure.blocks.at(j).instructions.at(position);
+
+                isRead = isRead || ((instruction.opcode == Opcode::LOAD_LOCAL || instruction.opcode == Opcode::STORE_LOCAL 
+                    || instruction.opcode == Opcode::ADDRESS_LOCAL) && instruction.immediate == procedure.parameters.at(i));
+            }
+        }
+
+        for (pair<int, int> load : loads) {
+            isRead = isRead || (load.second == i && allocation.locations.at(load.first) == "");
+
+            if (load.second == i && allocation.locations.at(load.first) != "") {
+                moves.push_back({ allocation.locations.at(load.first), ARGUMENT_REGISTERS.at(i) });
+            }
+        }
+
+        if (isRead) {
+            partialCode += saveInstruction(ARGUMENT_REGISTERS.at(i), frameOffset(procedure.parameters.at(i)), frameRegister);
+        }
+    }
+
+    partialCode += emitParallelMoves(moves);
+
+    bool isTailCallable = !procedure.isMain && options.tailCalls && !takesFrameAddresses(procedure);
+
+    for (int i = 0; i < procedure.blocks.size(); ++i) {
+        if (i > 0) {
+            partialCode += labelInstruction(procedure.blocks.at(i).label);
+        }
+
+        int tailCall = isTailCallable ? tailCallIndex(procedure, i) : -1;
+
+        for (int position = i == 0 ? loads.size() : 0; position < procedure.blocks.at(i).instructions.size(); ++position) {
+            Instruction& instruction = procedure.blocks.at(i).instructions.at(position);
+            int destination = instruction.destination;
+            string result = "$3";
+            vector<string> operands;
+
+            if (position == tailCall && instruction.operands.size() == procedure.parameters.size()) {
+                partialCode += emitTailCall(instruction, procedure, allocation);
+                break;
+            }
+
+            for (int j = 0; j < instruction.operands.size(); ++j) {
+                int operand = instruction.operands.at(j);
+
+                if (allocation.locations.at(operand) != "") {
+                    operands.push_back(allocation.locations.at(operand));
+                } else {
+                    operands.push_back(SCRATCH_REGISTERS.at(j % 2));
+
+                    if (instruction.opcode != Opcode::CALL) {
+                        partialCode += loadInstruction(operands.back(), frameOffset(allocation.slots.at(operand)), frameRegister);
+                    }
+                }
+            }
+
+            if (destination != -1 && allocation.locations.at(destination) != "") {
+                result = allocation.locations.at(destination);
+            }
+
+            if (instruction.opcode == Opcode::CALL) {
+                partialCode += emitCall(instruction, allocation);
+
+                if (result != "$3") {
+                    partialCode += addInstruction(result, "$3", "$0");
+                }
+            } else {
+                partialCode += emitOperation(instruction, procedure, operands, result, i + 1);
+            }
+
+            if (destination != -1 && allocation.locations.at(destination) == "") {
+                partialCode += saveInstruction(result, frameOffset(allocation.slots.at(destination)), frameRegister);
+            }
+
+            if (instruction.opcode == Opcode::RETURN) {
+                partialCode += emitRestores(allocation);
+                partialCode += emitEpilogue(allocation.frameSize);
+            }
+        }
+    }
+
+    string saves = "";
+
+    for (int i = 0; i < allocation.saved.size(); ++i) {
+        saves += saveInstruction(allocation.saved.at(i), frameOffset(savedSlot(allocation, i)), frameRegister);
+    }
+
+    return emitPrologue(procedure, allocation.frameSize, saves) + partialCode;
+}
+
+// A single line of assembly. Loads and stores keep their operands as register,
+// offset and base, and lis carries the word that follows it
+struct MachineInstruction {
+    string opcode;
+    vector<string> operands;
+};
+
+typedef bool (*PeepholeRule)(vector<MachineInstruction>&, int);
+
+const int PEEPHOLE_WINDOW = 16;
+
+// Registers that no caller reads after a procedure returns
+const unordered_set<string> RETURN_DEAD_REGISTERS = { "$1", "$2", "$5", "$6", "$7", "$8", "$9", "$10", "$12" };
+
+MachineInstruction createMachineInstruction(string opcode, vector<string> operands) {
+    MachineInstruction instruction;
+    instruction.opcode = opcode;
+    instruction.operands = operands;
+
+    return instruction;
+}
+
+vector<MachineInstruction> parseAssembly(string code) {
+    vector<MachineInstruction> instructions;
+    istringstream stream(code);
+    string line;
+
+    while (getline(stream, line)) {
+        if (line.back() == ':') {
+            instructions.push_back(createMachineInstruction("label", { line.substr(0, line.size() - 1) }));
+            continue;
+        }
+
+        int space = line.find(' ');
+        string opcode = line.substr(0, space);
+        string rest = line.substr(space + 1);
+        vector<string> operands;
+
+        if (opcode == ".word" && !instructions.empty() && instructions.back().opcode == "lis") {
+            instructions.back().operands.push_back(rest);
+            continue;
+        }
+
+        if (opcode == "lw" || opcode == "sw") {
+            int comma = rest.find(',');
+            int open = rest.find('(');
+
+            operands.push_back(rest.substr(0, comma));
+            operands.push_back(rest.substr(comma + 2, open - comma - 2));
+            operands.push_back(rest.substr(open + 1, rest.size() - open - 2));
+        } else {
+            int position = 0;
+            int comma;
+
+            while ((comma = rest.find(", ", position)) != string::npos) {
+                operands.push_back(rest.substr(position, comma - position));
+                position = comma + 2;
+            }
+
+            operands.push_back(rest.substr(position));
+        }
+
+        instructions.push_back(createMachineInstruction(opcode, operands));
+    }
+
+    // Branches over a fixed number of words are given labels so that rules
+    // can remove and insert instructions freely
+    for (int i = 0; i < instructions.size(); ++i) {
+        MachineInstruction& instruction = instructions.at(i);
+
+        if ((instruction.opcode == "beq" || instruction.opcode == "bne") && isNumber(instruction.operands.at(2)) && stoi(instruction.operands.at(2)) > 0) {
+            int words = stoi(instruction.operands.at(2));
+            int position = i + 1;
+            string label = generateLabel();
+
+            while (words > 0) {
+                string& opcode = instructions.at(position++).opcode;
+                words -= opcode == "lis" ? 2 : opcode == "label" || opcode == ".import" ? 0 : 1;
+            }
+
+            instruction.operands.at(2) = label;
+            instructions.insert(instructions.begin() + position, createMachineInstruction("label", { label }));
+        }
+    }
+
+    return instructions;
+}
+
+string renderAssembly(vector<MachineInstruction>& instructions) {
+    string partialCode = "";
+
+    for (MachineInstruction& instruction : instructions) {
+        string& opcode = instruction.opcode;
+        vector<string>& operands = instruction.operands;
+
+        if (opcode == "label") {
+            partialCode += labelInstruction(operands.at(0));
+        } else if (opcode == "lis") {
+            partialCode += loadSkipInstruction(operands.at(0), operands.at(1));
+        } else if (opcode == "lw") {
+            partialCode += loadInstruction(operands.at(0), operands.at(1), operands.at(2));
+        } else if (opcode == "sw") {
+            partialCode += saveInstruction(operands.at(0), operands.at(1), operands.at(2));
+        } else {
+            partialCode += opcode;
+
+            for (int i = 0; i < operands.size(); ++i) {
+                partialCode += (i == 0 ? " " : ", ") + operands.at(i);
+            }
+
+            partialCode += "\n";
+        }
+    }
+
+    return partialCode;
+}
+
+vector<string> readRegisters(MachineInstruction& instruction) {
+    string& opcode = instruction.opcode;
+    vector<string>& operands = instruction.operands;
+
+    if (opcode == "add" || opcode == "sub" || opcode == "slt" || opcode == "sltu") {
+        return { operands.at(1), operands.at(2) };
+    } else if (opcode == "mult" || opcode == "multu" || opcode == "div" || opcode == "divu" || opcode == "beq" || opcode == "bne") {
+        return { operands.at(0), operands.at(1) };
+    } else if (opcode == "lw") {
+        return { operands.at(2) };
+    } else if (opcode == "sw") {
+        return { operands.at(0), operands.at(2) };
+    } else if (opcode == "jr") {
+        return { operands.at(0) };
+    } else if (opcode == "jalr") {
+        return { operands.at(0), "$1", "$4", "$11", "$29", "$30" };
+    }
+
+    return {};
+}
+
+string writtenRegister(MachineInstruction& instruction) {
+    string& opcode = instruction.opcode;
+
+    if (opcode == "add" || opcode == "sub" || opcode == "slt" || opcode == "sltu" || opcode == "lw" || opcode == "lis" || opcode == "mflo" || opcode == "mfhi") {
+        return instruction.operands.at(0);
+    } else if (opcode == "jalr") {
+        return "$31";
+    }
+
+    return "";
+}
+
+bool readsRegister(MachineInstruction& instruction, string registerName) {
+    vector<string> registers = readRegisters(instruction);
+
+    return find(registers.begin(), registers.end(), registerName) != registers.end();
+}
+
+bool isControlTransfer(MachineInstruction& instruction) {
+    string& opcode = instruction.opcode;
+
+    return opcode == "label" || opcode == "beq" || opcode == "bne" || opcode == "jr" || opcode == "jalr";
+}
+
+// Whether the value in a register is never read after the given instruction.
+// Scratch registers never carry a value across a label, a branch or a call, and
+// calls leave nothing useful in $3
+bool isDeadAfter(vector<MachineInstruction>& instructions, int index, string registerName) {
+    bool isScratch = find(SCRATCH_REGISTERS.begin(), SCRATCH_REGISTERS.end(), registerName) != SCRATCH_REGISTERS.end();
+
+    for (int i = index + 1; i < instructions.size(); ++i) {
+        MachineInstruction& instruction = instructions.at(i);
+
+        if (readsRegister(instruction, registerName)) {
+            return false;
+        } else if (instruction.opcode == "jr") {
+            return RETURN_DEAD_REGISTERS.find(registerName) != RETURN_DEAD_REGISTERS.end();
+        } else if (instruction.opcode == "jalr") {
+            return isScratch || registerName == "$3" || registerName == "$31";
+        } else if (isControlTransfer(instruction)) {
+            return isScratch;
+        } else if (writtenRegister(instruction) == registerName) {
+            return true;
+        }
+    }
+
+    return true;
+}
+
+bool isStackAdjustment(MachineInstruction& instruction, string amount) {
+    return (instruction.opcode == "add" || instruction.opcode == "sub") 
+        && instruction.operands.at(0) == "$30" && instruction.operands.at(1) == "$30" && instruction.operands.at(2) == amount;
+}
+
+bool isPush(vector<MachineInstruction>& instructions, int index) {
+    return index + 1 < instructions.size() && instructions.at(index).opcode == "sw" 
+        && instructions.at(index).operands.at(1) == "-4" && instructions.at(index).operands.at(2) == "$30"
+        && instructions.at(index + 1).opcode == "sub" && isStackAdjustment(instructions.at(index + 1), "$4");
+}
+
+bool isPop(vector<MachineInstruction>& instructions, int index) {
+    return index + 1 < instructions.size() && instructions.at(index).opcode == "add" && isStackAdjustment(instructions.at(index), "$4")
+        && instructions.at(index + 1).opcode == "lw" && instructions.at(index + 1).operands.at(1) == "-4" && instructions.at(index + 1).operands.at(2) == "$30";
+}
+
+// A push whose value is popped again before the stack is otherwise used
+// becomes a move, or disappears when the value returns to the same register
+bool combinePushPop(vector<MachineInstruction>& instructions, int index) {
+    if (!isPush(instructions, index)) {
+        return false;
+    }
+
+    string value = instructions.at(index).operands.at(0);
+    unordered_set<string> touched;
+    unordered_set<string> written;
+
+    for (int i = index + 2; i < instructions.size() && i < index + 2 + PEEPHOLE_WINDOW; ++i) {
+        MachineInstruction& instruction = instructions.at(i);
+
+        if (isPop(instructions, i)) {
+            string target = instructions.at(i + 1).operands.at(0);
+
+            if (target == value ? written.count(value) : touched.count(target)) {
+                return false;
+            }
+
+            instructions.erase(instructions.begin() + i, instructions.begin() + i + 2);
+            instructions.erase(instructions.begin() + index, instructions.begin() + index + 2);
+
+            if (target != value) {
+                instructions.insert(instructions.begin() + index, createMachineInstruction("add", { target, value, "$0" }));
+            }
+
+            return true;
+        } else if (isControlTransfer(instruction)) {
+            return false;
+        }
+
+        for (string& read : readRegisters(instruction)) {
+            touched.insert(read);
+        }
+
+        if (writtenRegister(instruction) != "") {
+            touched.insert(writtenRegister(instruction));
+            written.insert(writtenRegister(instruction));
+        }
+
+        if (touched.count("$30")) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// A load from a slot that was just stored or loaded becomes a move when the
+// register and the base still hold the same values
+bool forwardMemory(vector<MachineInstruction>& instructions, int index) {
+    MachineInstruction& access = instructions.at(index);
+
+    if ((access.opcode != "sw" && access.opcode != "lw") || (access.opcode == "lw" && access.operands.at(0) == access.operands.at(2))) {
+        return false;
+    }
+
+    string value = access.operands.at(0);
+    string offset = access.operands.at(1);
+    string base = access.operands.at(2);
+
+    for (int i = index + 1; i < instructions.size() && i < index + 1 + PEEPHOLE_WINDOW; ++i) {
+        MachineInstruction& instruction = instructions.at(i);
+
+        if (instruction.opcode == "lw" && instruction.operands.at(1) == offset && instruction.operands.at(2) == base) {
+            string target = instruction.operands.at(0);
+
+            if (target == value) {
+                instructions.erase(instructions.begin() + i);
+            } else {
+                instruction = createMachineInstruction("add", { target, value, "$0" });
+            }
+
+            return true;
+        } else if (isControlTransfer(instruction) || writtenRegister(instruction) == value || writtenRegister(instruction) == base) {
+            return false;
+        } else if (instruction.opcode == "sw" && (instruction.operands.at(2) != base || instruction.operands.at(1) == offset)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// A value computed into a register that is only moved elsewhere is computed
+// in the destination of the move instead
+bool forwardCopy(vector<MachineInstruction>& instructions, int index) {
+    if (index + 1 >= instructions.size()) {
+        return false;
+    }
+
+    MachineInstruction& producer = instructions.at(index);
+    MachineInstruction& move = instructions.at(index + 1);
+    string source = writtenRegister(producer);
+
+    if (source == "" || source == "$0" || producer.opcode == "jalr" || move.opcode != "add") {
+        return false;
+    }
+
+    string target = move.operands.at(0);
+    bool isMove = (move.operands.at(1) == source && move.operands.at(2) == "$0") || (move.operands.at(1) == "$0" && move.operands.at(2) == source);
+
+    if (!isMove || target == source || target == "$0" || !isDeadAfter(instructions, index + 1, source)) {
+        return false;
+    }
+
+    producer.operands.at(0) = target;
+    instructions.erase(instructions.begin() + index + 1);
+
+    return true;
+}
+
+bool removeSelfMove(vector<MachineInstruction>& instructions, int index) {
+    MachineInstruction& move = instructions.at(index);
+    vector<string>& operands = move.operands;
+
+    if (move.opcode != "add" || !((operands.at(0) == operands.at(1) && operands.at(2) == "$0") || (operands.at(0) == operands.at(2) && operands.at(1) == "$0"))) {
+        return false;
+    }
+
+    instructions.erase(instructions.begin() + index);
+
+    return true;
+}
+
+// Moves a stack pointer adjustment below a load or store relative to the stack
+// pointer, so that adjustments gather next to each other
+bool sinkStackAdjustment(vector<MachineInstruction>& instructions, int index) {
+    int length = 1;
+    int amount = 4;
+
+    if (index + 2 < instructions.size() && instructions.at(index).opcode == "lis" && instructions.at(index).operands.at(0) == SCRATCH_REGISTERS.at(0)
+        && isNumber(instructions.at(index).operands.at(1)) && isStackAdjustment(instructions.at(index + 1), SCRATCH_REGISTERS.at(0))) {
+        length = 2;
+        amount = stoi(instructions.at(index).operands.at(1));
+    } else if (index + 1 >= instructions.size() || !isStackAdjustment(instructions.at(index), "$4")) {
+        return false;
+    }
+
+    MachineInstruction& access = instructions.at(index + length);
+    string sign = instructions.at(index + length - 1).opcode;
+
+    if ((access.opcode != "lw" && access.opcode != "sw") || access.operands.at(2) != "$30" || access.operands.at(0) == "$30" 
+        || (access.opcode == "lw" && access.operands.at(0) == SCRATCH_REGISTERS.at(0))) {
+        return false;
+    }
+
+    access.operands.at(1) = to_string(stoi(access.operands.at(1)) + (sign == "add" ? amount : -amount));
+    rotate(instructions.begin() + index, instructions.begin() + index + length, instructions.begin() + index + length + 1);
+
+    return true;
+}
+
+// Replaces a run of stack pointer adjustments with the cheapest equivalent,
+// either repeated additions of $4 or a single constant in $12
+bool mergeStackAdjustments(vector<MachineInstruction>& instructions, int index) {
+    int position = index;
+    int total = 0;
+    int executed = 0;
+    int words = 0;
+    bool usesScratch = false;
+
+    while (position < instructions.size()) {
+        MachineInstruction& instruction = instructions.at(position);
+
+        if (isStackAdjustment(instruction, "$4")) {
+            total += instruction.opcode == "add" ? 4 : -4;
+            executed += 1;
+            words += 1;
+            position += 1;
+        } else if (instruction.opcode == "lis" && instruction.operands.at(0) == SCRATCH_REGISTERS.at(0) && isNumber(instruction.operands.at(1))
+            && position + 1 < instructions.size() && isStackAdjustment(instructions.at(position + 1), SCRATCH_REGISTERS.at(0))) {
+            total += (instructions.at(position + 1).opcode == "add" ? 1 : -1) * stoi(instruction.operands.at(1));
+            executed += 2;
+            words += 3;
+            position += 2;
+            usesScratch = true;
+        } else {
+            break;
+        }
+    }
+
+    if (position == index || total % 4 != 0) {
+        return false;
+    }
+
+    int count = abs(total) / 4;
+    bool isShort = count <= 2;
+    int bestExecuted = isShort ? count : 2;
+    int bestWords = isShort ? count : 3;
+
+    if (bestExecuted > executed || (bestExecuted == executed && bestWords >= words)) {
+        return false;
+    } else if ((usesScratch || !isShort) && !isDeadAfter(instructions, position - 1, SCRATCH_REGISTERS.at(0))) {
+        return false;
+    }
+
+    vector<MachineInstruction> replacement;
+    string opcode = total > 0 ? "add" : "sub";
+
+    if (isShort) {
+        replacement.assign(count, createMachineInstruction(opcode, { "$30", "$30", "$4" }));
+    } else {
+        replacement.push_back(createMachineInstruction("lis", { SCRATCH_REGISTERS.at(0), to_string(abs(total)) }));
+        replacement.push_back(createMachineInstruction(opcode, { "$30", "$30", SCRATCH_REGISTERS.at(0) }));
+    }
+
+    instructions.erase(instructions.begin() + index, instructions.begin() + position);
+    instructions.insert(instructions.begin() + index, replacement.begin(), replacement.end());
+
+    return true;
+}
+
+// Removes branches to a label that immediately follows them
+bool removeJumpToNext(vector<MachineInstruction>& instructions, int index) {
+    MachineInstruction& branch = instructions.at(index);
+
+    if (branch.opcode != "beq" && branch.opcode != "bne") {
+        return false;
+    }
+
+    for (int i = index + 1; i < instructions.size() && instructions.at(i).opcode == "label"; ++i) {
+        if (instructions.at(i).operands.at(0) == branch.operands.at(2)) {
+            instructions.erase(instructions.begin() + index);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// A rule from a file the superoptimizer writes. Registers named r0, r1, ...
+// stand for distinct registers other than $0, $4 and $11, words named k0, k1,
+// ... for any word, and the registers listed as dead must not be read after
+// the pattern
+struct RewriteRule {
+    vector<MachineInstruction> pattern;
+    vector<MachineInstruction> replacement;
+    vector<string> dead;
+};
+
+vector<RewriteRule> rewriteRules;
+
+const unordered_map<string, int> REWRITE_OPERAND_COUNTS = {
+    { "add", 3 }, { "sub", 3 }, { "slt", 3 }, { "sltu", 3 }, { "mult", 2 }, { "multu", 2 }, { "div", 2 },
+    { "divu", 2 }, { "mflo", 1 }, { "mfhi", 1 }, { "lis", 2 }, { "lw", 3 }, { "sw", 3 }
+};
+
+bool isWordOperand(string opcode, int index) {
+    return (opcode == "lis" || opcode == "lw" || opcode == "sw") && index == 1;
+}
+
+bool isRewriteSymbol(string operand, bool isWord) {
+    return operand.size() > 1 && operand.at(0) == (isWord ? 'k' : 'r') && isNumber(operand.substr(1));
+}
+
+// The file starts with the number of rules. Each rule is a line with the
+// number of lines in its pattern and in its replacement followed by the
+// registers that must be dead, and then those lines of assembly. Rules may
+// only hold straight-line code and only name what their pattern names
+bool readPeepholeRules(string file) {
+    ifstream input(file);
+    string line;
+
+    if (!getline(input, line) || !isNumber(line)) {
+        return false;
+    }
+
+    int count = stoi(line);
+
+    for (int i = 0; i < count; ++i) {
+        RewriteRule rule;
+        string code[2] = { "", "" };
+        int lengths[2];
+        string name;
+
+        if (!getline(input, line)) {
+            return false;
+        }
+
+        istringstream header(line);
+
+        if (!(header >> lengths[0] >> lengths[1]) || lengths[0] <= 0 || lengths[1] < 0) {
+            return false;
+        }
+
+        while (header >> name) {
+            rule.dead.push_back(name);
+        }
+
+        for (int j = 0; j < lengths[0] + lengths[1]; ++j) {
+            if (!getline(input, line) || line.empty()) {
+                return false;
+            }
+
+            code[j < lengths[0] ? 0 : 1] += line + "\n";
+        }
+
+        rule.pattern = parseAssembly(code[0]);
+        rule.replacement = parseAssembly(code[1]);
+
+        unordered_set<string> names;
+
+        for (int j = 0; j < 2; ++j) {
+            for (MachineInstruction& instruction : j == 0 ? rule.pattern : rule.replacement) {
+                unordered_map<string, int>::const_iterator operands = REWRITE_OPERAND_COUNTS.find(instruction.opcode);
+
+                if (operands == REWRITE_OPERAND_COUNTS.end() || operands->second != instruction.operands.size()) {
+                    return false;
+                }
+
+                for (int k = 0; k < instruction.operands.size(); ++k) {
+                    string& operand = instruction.operands.at(k);
+
+                    if (isRewriteSymbol(operand, isWordOperand(instruction.opcode, k))) {
+                        if (j == 0) {
+                            names.insert(operand);
+                        } else if (names.find(operand) == names.end()) {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+
+        for (string& dead : rule.dead) {
+            if (names.find(dead) == names.end()) {
+                return false;
+            }
+        }
+
+        rewriteRules.push_back(rule);
+    }
+
+    return true;
+}
+
+// Binds a symbol of a rule to an operand, or checks that a literal matches
+bool bindOperand(string symbol, string operand, bool isWord, unordered_map<string, string>& bindings) {
+    if (!isRewriteSymbol(symbol, isWord)) {
+        return symbol == operand;
+    } else if (!isWord && (operand == "$0" || operand == "$4" || operand == "$11")) {
+        return false;
+    } else if (bindings.find(symbol) != bindings.end()) {
+        return bindings[symbol] == operand;
+    }
+
+    for (pair<const string, string>& binding : bindings) {
+        if (!isWord && binding.second == operand && isRewriteSymbol(binding.first, false)) {
+            return false;
+        }
+    }
+
+    bindings[symbol] = operand;
+
+    return true;
+}
+
+// Tries the loaded rules in the order of the file
+bool applyRewriteRules(vector<MachineInstruction>& instructions, int index) {
+    for (RewriteRule& rule : rewriteRules) {
+        unordered_map<string, string> bindings;
+        bool isMatch = index + rule.pattern.size() <= instructions.size();
+
+        for (int i = 0; isMatch && i < rule.pattern.size(); ++i) {
+            MachineInstruction& symbolic = rule.pattern.at(i);
+            MachineInstruction& instruction = instructions.at(index + i);
+
+            isMatch = symbolic.opcode == instruction.opcode && symbolic.operands.size() == instruction.operands.size();
+
+            for (int j = 0; isMatch && j < symbolic.operands.size(); ++j) {
+                isMatch = bindOperand(symbolic.operands.at(j), instruction.operands.at(j), isWordOperand(symbolic.opcode, j), bindings);
+            }
+        }
+
+        for (int i = 0; isMatch && i < rule.dead.size(); ++i) {
+            isMatch = isDeadAfter(instructions, index + rule.pattern.size() - 1, bindings[rule.dead.at(i)]);
+        }
+
+        if (!isMatch) {
+            continue;
+        }
+
+        vector<MachineInstruction> replacement = rule.replacement;
+
+        for (MachineInstruction& instruction : replacement) {
+            for (string& operand : instruction.operands) {
+                if (bindings.find(operand) != bindings.end()) {
+                    operand = bindings[operand];
+                }
+            }
+        }
+
+        instructions.erase(instructions.begin() + index, instructions.begin() + index + rule.pattern.size());
+        instructions.insert(instructions.begin() + index, replacement.begin(), replacement.end());
+
+        return true;
+    }
+
+    return false;
+}
+
+// Rules are tried in order, each over the whole program, until none applies
+const vector<pair<string, PeepholeRule>> PEEPHOLE_RULES = {
+    { "push-pop", combinePushPop },
+    { "load-forwarding", forwardMemory },
+    { "copy-forwarding", forwardCopy },
+    { "self-move", removeSelfMove },
+    { "stack-sinking", sinkStackAdjustment },
+    { "stack-adjustment", mergeStackAdjustments },
+    { "jump-to-next", removeJumpToNext },
+    { "loaded-rules", applyRewriteRules }
+};
+
+string optimizeAssembly(string code) {
+    vector<MachineInstruction> instructions = parseAssembly(code);
+    vector<int> counts(PEEPHOLE_RULES.size(), 0);
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < PEEPHOLE_RULES.size(); ++i) {
+            for (int j = 0; j < instructions.size(); ++j) {
+                while (j < instructions.size() && PEEPHOLE_RULES.at(i).second(instructions, j)) {
+                    ++counts.at(i);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (options.report) {
+        for (int i = 0; i < PEEPHOLE_RULES.size(); ++i) {
+            cerr << "peephole " << PEEPHOLE_RULES.at(i).first << ": " << counts.at(i) << endl;
+        }
+    }
+
+    return renderAssembly(instructions);
+}
+
+// Procedures that wain can reach through calls left after optimization
+unordered_set<string> reachableProcedures(vector<Procedure>& procedures) {
+    unordered_map<string, Procedure*> names;
+    unordered_set<string> reachable = { "wain" };
+    vector<string> worklist = { "wain" };
+
+    for (Procedure& procedure : procedures) {
+        names[procedure.name] = &procedure;
+    }
+
+    while (!worklist.empty()) {
+        Procedure& procedure = *names[worklist.back()];
+        worklist.pop_back();
+
+        for (BasicBlock& block : procedure.blocks) {
+            for (Instruction& instruction : block.instructions) {
+                if (instruction.opcode == Opcode::CALL && reachable.insert(instruction.symbol).second) {
+                    worklist.push_back(instruction.symbol);
+                }
+            }
+        }
+    }
+
+    return reachable;
+}
+
+// Prints the counters in the format readProfile expects, followed by the
+// table of counters itself
+string emitProfileDump() {
+    string partialCode = "";
+    string loop = generateLabel();
+
+    if (!printIncluded) {
+        partialCode += importInstruction("print");
+        printIncluded = true;
+    }
+
+    partialCode += labelInstruction(PROFILE_DUMP);
+    partialCode += pushInstruction("$31");
+    partialCode += pushInstruction("$3");
+    partialCode += pushInstruction("$5");
+    partialCode += pushInstruction("$6");
+    partialCode += loadSkipInstruction("$5", PROFILE_TABLE);
+    partialCode += loadSkipInstruction("$6", to_string(3 * profileCounters.size()));
+    partialCode += labelInstruction(loop);
+    partialCode += loadInstruction("$1", "0", "$5");
+    partialCode += loadSkipInstruction("$10", "print");
+    partialCode += jumpLinkInstruction("$10");
+    partialCode += addInstruction("$5", "$5", "$4");
+    partialCode += subtractInstruction("$6", "$6", "$11");
+    partialCode += branchNotEqualInstruction("$6", "$0", loop);
+    partialCode += loadSkipInstruction("$1", to_string(profileCounters.size()));
+    partialCode += loadSkipInstruction("$10", "print");
+    partialCode += jumpLinkInstruction("$10");
+    partialCode += popInstruction("$6");
+    partialCode += popInstruction("$5");
+    partialCode += popInstruction("$3");
+    partialCode += popInstruction("$31");
+    partialCode += jumpInstruction("$31");
+    partialCode += labelInstruction(PROFILE_TABLE);
+
+    for (pair<int, int> counter : profileCounters) {
+        partialCode += ".word " + to_string(counter.first) + "\n";
+        partialCode += ".word " + to_string(counter.second) + "\n";
+        partialCode += ".word 0\n";
+    }
+
+    return partialCode;
+}
+
+// Only procedures reachable from wain are emitted, and the heap is set up only
+// when one of them allocates or deletes. With a profile, procedures follow
+// wain from the most often called down
+string emitProgram(vector<Procedure>& procedures) {
+    string partialCode = "";
+
+    if (options.wholeProgram) {
+        unordered_set<string> reachable = reachableProcedures(procedures);
+        int count = procedures.size();
+
+        procedures.erase(remove_if(procedures.begin(), procedures.end(), [&reachable](Procedure& procedure) {
+            return reachable.find(procedure.name) == reachable.end();
+        }), procedures.end());
+
+        heapIncluded = false;
+
+        for (Procedure& procedure : procedures) {
+            for (BasicBlock& block : procedure.blocks) {
+                for (Instruction& instruction : block.instructions) {
+                    heapIncluded = heapIncluded || instruction.opcode == Opcode::NEW || instruction.opcode == Opcode::DELETE;
+                }
+            }
+        }
+
+        if (options.report) {
+            cerr << "whole program: " << count - procedures.size() << " unreachable procedures removed" << endl;
+        }
+    }
+
+    for (Procedure& procedure : procedures) {
+        if (options.leafProcedures && options.registerExpressions && isLeaf(procedure)) {
+            leafProcedures.insert(procedure.name);
+        }
+    }
+
+    if (!options.profileUse.empty()) {
+        stable_sort(procedures.begin(), procedures.end() - 1, [](const Procedure& first, const Procedure& second) {
+            return first.blocks.at(0).count < second.blocks.at(0).count;
+        });
+    }
+
+    for (int i = procedures.size() - 1; i >= 0; --i) {
+        partialCode += options.registerExpressions ? emitRegisterProcedure(procedures.at(i)) : emitStackProcedure(procedures.at(i));
+    }
+
+    if (options.profileGenerate) {
+        partialCode += emitProfileDump();
+    }
+
+    if (options.report) {
+        cerr << "strength reduction: " << removedMultiplications << " mult, " << removedDivisions << " div removed" << endl;
+    }
+
+    return options.peephole ? optimizeAssembly(partialCode) : partialCode;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parseOptions(argc, argv)) {
+        cerr << "ERROR" << endl;
+        return 0;
+    }
+
+    vector<tuple<string, string, vector<string>>> input = acquireInput();
+    unordered_map<string, Scope> symbols;
+
+    if (input.size() == 0) {
+        return 0;
+    }
+
+    int childrenCount = 0;
+    Node parseTree = createParseTree(input, 0, childrenCount);
+
+    if (checkDeclaration(parseTree, symbols, "", false, 0)) {
+        if (checkUndeclared(parseTree, symbols, "")) {
+            if (checkType(parseTree, symbols, "")) {
+                vector<Procedure> procedures;
+
+                lowerProcedures(parseTree.children.at(1), symbols, procedures);
+                optimize(procedures);
+                output(emitProgram(procedures));
                 return 0;
             }
         }
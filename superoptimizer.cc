@@ -0,0 +1,923 @@
+//--------------------------------------------------------------------
+//| Superoptimizer to search for peephole rules over generated MIPS |
+//--------------------------------------------------------------------
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// Registers the generator never writes once wain has started, with the values
+// they hold from then on
+const vector<pair<string, unsigned int>> FIXED_REGISTERS = { { "$0", 0 }, { "$4", 4 }, { "$11", 1 } };
+
+// Longest window taken from the code, longest replacement searched for, how
+// many patterns are searched and how often they must occur first
+const int PATTERN_LENGTH = 4;
+const int REPLACEMENT_LENGTH = 2;
+const int PATTERN_LIMIT = 400;
+const int MINIMUM_OCCURRENCES = 2;
+
+// Random states a candidate must survive before it is proven, and how many
+// survivors are kept for proving
+const int TEST_COUNT = 8;
+const int CANDIDATE_LIMIT = 4096;
+
+const unordered_set<string> STRAIGHT_LINE_OPCODES = {
+    "add", "sub", "slt", "sltu", "mult", "multu", "div", "divu", "mflo", "mfhi", "lis", "lw", "sw"
+};
+
+struct MachineInstruction {
+    string opcode;
+    vector<string> operands;
+};
+
+enum Opcode {
+    ADD,
+    SUB,
+    SLT,
+    SLTU,
+    MULT,
+    MULTU,
+    DIV,
+    DIVU,
+    MFLO,
+    MFHI,
+    LIS,
+    LW,
+    SW
+};
+
+const vector<string> OPCODE_NAMES = { "add", "sub", "slt", "sltu", "mult", "multu", "div", "divu", "mflo", "mfhi", "lis", "lw", "sw" };
+
+// An instruction over the slots of a pattern. Registers of the pattern come
+// first, then the fixed registers, and words are numbered separately. Loads
+// and stores keep register, word and base
+struct Operation {
+    Opcode opcode;
+    int first = -1;
+    int second = -1;
+    int third = -1;
+};
+
+// The names a pattern uses for its registers and its words
+struct Context {
+    vector<string> registers;
+    vector<string> words;
+};
+
+struct Rule {
+    vector<MachineInstruction> pattern;
+    vector<MachineInstruction> replacement;
+    vector<string> dead;
+};
+
+MachineInstruction createMachineInstruction(string opcode, vector<string> operands) {
+    MachineInstruction instruction;
+    instruction.opcode = opcode;
+    instruction.operands = operands;
+
+    return instruction;
+}
+
+bool isNumber(string value) {
+    int start = !value.empty() && value.at(0) == '-' ? 1 : 0;
+
+    if (start == value.size()) {
+        return false;
+    }
+
+    for (int i = start; i < value.size(); ++i) {
+        if (!isdigit(value.at(i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool isFixedRegister(string name) {
+    for (const pair<string, unsigned int>& fixed : FIXED_REGISTERS) {
+        if (fixed.first == name) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool isWordOperand(string opcode, int index) {
+    return (opcode == "lis" || opcode == "lw" || opcode == "sw") && index == 1;
+}
+
+string writtenRegister(MachineInstruction& instruction) {
+    string& opcode = instruction.opcode;
+
+    if (opcode == "add" || opcode == "sub" || opcode == "slt" || opcode == "sltu" || opcode == "lw" || opcode == "lis" || opcode == "mflo" || opcode == "mfhi") {
+        return instruction.operands.at(0);
+    }
+
+    return "";
+}
+
+int instructionWords(vector<Operation>& operations) {
+    int words = 0;
+
+    for (Operation& operation : operations) {
+        words += operation.opcode == LIS ? 2 : 1;
+    }
+
+    return words;
+}
+
+// Straight-line runs of instructions in a file of generated assembly, ended by
+// labels, branches, calls, returns and data
+vector<vector<MachineInstruction>> readRuns(string file) {
+    ifstream input(file);
+    vector<vector<MachineInstruction>> runs(1);
+    string line;
+
+    while (getline(input, line)) {
+        int space = line.find(' ');
+        string opcode = line.substr(0, space);
+        string rest = space == string::npos ? "" : line.substr(space + 1);
+        vector<MachineInstruction>& run = runs.back();
+        vector<string> operands;
+
+        if (opcode == ".word" && !run.empty() && run.back().opcode == "lis" && run.back().operands.size() == 1) {
+            run.back().operands.push_back(rest);
+            continue;
+        } else if (STRAIGHT_LINE_OPCODES.find(opcode) == STRAIGHT_LINE_OPCODES.end()) {
+            if (!run.empty()) {
+                runs.push_back({});
+            }
+
+            continue;
+        }
+
+        if (opcode == "lw" || opcode == "sw") {
+            int comma = rest.find(',');
+            int open = rest.find('(');
+
+            operands.push_back(rest.substr(0, comma));
+            operands.push_back(rest.substr(comma + 2, open - comma - 2));
+            operands.push_back(rest.substr(open + 1, rest.size() - open - 2));
+        } else {
+            int position = 0;
+            int comma;
+
+            while ((comma = rest.find(", ", position)) != string::npos) {
+                operands.push_back(rest.substr(position, comma - position));
+                position = comma + 2;
+            }
+
+            operands.push_back(rest.substr(position));
+        }
+
+        run.push_back(createMachineInstruction(opcode, operands));
+    }
+
+    return runs;
+}
+
+string renderAssembly(vector<MachineInstruction>& instructions) {
+    string code = "";
+
+    for (MachineInstruction& instruction : instructions) {
+        vector<string>& operands = instruction.operands;
+
+        if (instruction.opcode == "lis") {
+            code += "lis " + operands.at(0) + "\n.word " + operands.at(1) + "\n";
+        } else if (instruction.opcode == "lw" || instruction.opcode == "sw") {
+            code += instruction.opcode + " " + operands.at(0) + ", " + operands.at(1) + "(" + operands.at(2) + ")\n";
+        } else {
+            code += instruction.opcode;
+
+            for (int i = 0; i < operands.size(); ++i) {
+                code += (i == 0 ? " " : ", ") + operands.at(i);
+            }
+
+            code += "\n";
+        }
+    }
+
+    return code;
+}
+
+// Renames registers to r0, r1, ... and words to k0, k1, ... in the order they
+// first appear, so windows that differ only in those share a pattern. Fixed
+// registers stay, and so do small words that lis loads, since rules often
+// depend on their values. Windows that write a fixed register are left out
+bool canonicalize(vector<MachineInstruction>& window, Context& context) {
+    map<string, string> registers;
+    map<string, string> words;
+
+    for (MachineInstruction& instruction : window) {
+        if (isFixedRegister(writtenRegister(instruction))) {
+            return false;
+        }
+
+        for (int i = 0; i < instruction.operands.size(); ++i) {
+            string& operand = instruction.operands.at(i);
+
+            if (isWordOperand(instruction.opcode, i)) {
+                if (instruction.opcode == "lis" && isNumber(operand) && operand.size() < 3 && abs(stoi(operand)) <= 4) {
+                    if (find(context.words.begin(), context.words.end(), operand) == context.words.end()) {
+                        context.words.push_back(operand);
+                    }
+                } else {
+                    if (words.find(operand) == words.end()) {
+                        string name = "k" + to_string(words.size());
+                        words[operand] = name;
+                    }
+
+                    operand = words[operand];
+
+                    if (find(context.words.begin(), context.words.end(), operand) == context.words.end()) {
+                        context.words.push_back(operand);
+                    }
+                }
+            } else if (!isFixedRegister(operand)) {
+                if (registers.find(operand) == registers.end()) {
+                    string name = "r" + to_string(registers.size());
+                    registers[operand] = name;
+                    context.registers.push_back(name);
+                }
+
+                operand = registers[operand];
+            }
+        }
+    }
+
+    return true;
+}
+
+int registerSlot(string name, Context& context) {
+    for (int i = 0; i < FIXED_REGISTERS.size(); ++i) {
+        if (FIXED_REGISTERS.at(i).first == name) {
+            return context.registers.size() + i;
+        }
+    }
+
+    return find(context.registers.begin(), context.registers.end(), name) - context.registers.begin();
+}
+
+string registerName(int slot, Context& context) {
+    return slot < context.registers.size() ? context.registers.at(slot) : FIXED_REGISTERS.at(slot - context.registers.size()).first;
+}
+
+Operation decode(MachineInstruction& instruction, Context& context) {
+    Operation operation;
+    vector<string>& operands = instruction.operands;
+
+    operation.opcode = static_cast<Opcode>(find(OPCODE_NAMES.begin(), OPCODE_NAMES.end(), instruction.opcode) - OPCODE_NAMES.begin());
+
+    for (int i = 0; i < operands.size(); ++i) {
+        int slot = isWordOperand(instruction.opcode, i) ? find(context.words.begin(), context.words.end(), operands.at(i)) - context.words.begin()
+            : registerSlot(operands.at(i), context);
+
+        (i == 0 ? operation.first : i == 1 ? operation.second : operation.third) = slot;
+    }
+
+    return operation;
+}
+
+MachineInstruction encode(Operation& operation, Context& context) {
+    string opcode = OPCODE_NAMES.at(operation.opcode);
+    vector<string> operands;
+
+    for (int i = 0; i < 3; ++i) {
+        int slot = i == 0 ? operation.first : i == 1 ? operation.second : operation.third;
+
+        if (slot != -1) {
+            operands.push_back(isWordOperand(opcode, i) ? context.words.at(slot) : registerName(slot, context));
+        }
+    }
+
+    return createMachineInstruction(opcode, operands);
+}
+
+// Every instruction a replacement may use. It writes only registers of the
+// pattern and loads only through them, and it never divides, so that it can
+// not fault where the pattern does not
+vector<Operation> candidateOperations(Context& context) {
+    vector<Operation> operations;
+    int destinations = context.registers.size();
+    int sources = destinations + FIXED_REGISTERS.size();
+
+    for (Opcode opcode : { ADD, SUB, SLT, SLTU }) {
+        for (int destination = 0; destination < destinations; ++destination) {
+            for (int left = 0; left < sources; ++left) {
+                for (int right = opcode == ADD ? left : 0; right < sources; ++right) {
+                    operations.push_back({ opcode, destination, left, right });
+                }
+            }
+        }
+    }
+
+    for (int destination = 0; destination < destinations; ++destination) {
+        operations.push_back({ MFLO, destination });
+        operations.push_back({ MFHI, destination });
+
+        for (int word = 0; word < context.words.size(); ++word) {
+            operations.push_back({ LIS, destination, word });
+        }
+    }
+
+    for (int left = 0; left < sources; ++left) {
+        for (int right = left; right < sources; ++right) {
+            operations.push_back({ MULT, left, right });
+            operations.push_back({ MULTU, left, right });
+        }
+
+        for (int word = 0; word < context.words.size(); ++word) {
+            for (int base = 0; base < sources; ++base) {
+                if (left < destinations) {
+                    operations.push_back({ LW, left, word, base });
+                }
+
+                operations.push_back({ SW, left, word, base });
+            }
+        }
+    }
+
+    return operations;
+}
+
+// A concrete machine state. Memory that was never stored holds a hash of its
+// address, and every address read or written is recorded
+struct State {
+    vector<unsigned int> registers;
+    vector<unsigned int> words;
+    unsigned int hi = 0;
+    unsigned int lo = 0;
+    unsigned int seed = 0;
+    vector<pair<unsigned int, unsigned int>> stores;
+    vector<unsigned int> accesses;
+    vector<unsigned int> loads;
+};
+
+unsigned int loadWord(State& state, unsigned int address) {
+    for (int i = state.stores.size() - 1; i >= 0; --i) {
+        if (state.stores.at(i).first == address) {
+            return state.stores.at(i).second;
+        }
+    }
+
+    unsigned int hash = (address ^ state.seed) * 2654435761u;
+
+    return hash ^ (hash >> 15);
+}
+
+void execute(vector<Operation>& operations, State& state) {
+    vector<unsigned int>& registers = state.registers;
+
+    for (Operation& operation : operations) {
+        switch (operation.opcode) {
+            case ADD:
+                registers.at(operation.first) = registers.at(operation.second) + registers.at(operation.third);
+                break;
+            case SUB:
+                registers.at(operation.first) = registers.at(operation.second) - registers.at(operation.third);
+                break;
+            case SLT:
+                registers.at(operation.first) = static_cast<int>(registers.at(operation.second)) < static_cast<int>(registers.at(operation.third));
+                break;
+            case SLTU:
+                registers.at(operation.first) = registers.at(operation.second) < registers.at(operation.third);
+                break;
+            case MULT:
+            case MULTU: {
+                long long product = operation.opcode == MULT
+                    ? static_cast<long long>(static_cast<int>(registers.at(operation.first))) * static_cast<int>(registers.at(operation.second))
+                    : static_cast<long long>(static_cast<unsigned long long>(registers.at(operation.first)) * registers.at(operation.second));
+                state.lo = static_cast<unsigned int>(product);
+                state.hi = static_cast<unsigned int>(static_cast<unsigned long long>(product) >> 32);
+                break;
+            }
+            case DIV:
+            case DIVU: {
+                long long dividend = operation.opcode == DIV ? static_cast<int>(registers.at(operation.first)) : registers.at(operation.first);
+                long long divisor = operation.opcode == DIV ? static_cast<int>(registers.at(operation.second)) : registers.at(operation.second);
+                state.lo = divisor == 0 ? 0 : static_cast<unsigned int>(dividend / divisor);
+                state.hi = divisor == 0 ? 0 : static_cast<unsigned int>(dividend % divisor);
+                break;
+            }
+            case MFLO:
+                registers.at(operation.first) = state.lo;
+                break;
+            case MFHI:
+                registers.at(operation.first) = state.hi;
+                break;
+            case LIS:
+                registers.at(operation.first) = state.words.at(operation.second);
+                break;
+            case LW: {
+                unsigned int address = registers.at(operation.third) + state.words.at(operation.second);
+                state.accesses.push_back(address);
+                state.loads.push_back(address);
+                registers.at(operation.first) = loadWord(state, address);
+                break;
+            }
+            case SW: {
+                unsigned int address = registers.at(operation.third) + state.words.at(operation.second);
+                state.accesses.push_back(address);
+                state.stores.push_back({ address, registers.at(operation.first) });
+                break;
+            }
+        }
+    }
+}
+
+vector<State> createTests(Context& context) {
+    mt19937 random(241);
+    vector<State> tests;
+
+    for (int i = 0; i < TEST_COUNT; ++i) {
+        State state;
+
+        for (int j = 0; j < context.registers.size(); ++j) {
+            state.registers.push_back(i % 2 == 0 ? random() : random() % 16 - 8);
+        }
+
+        for (const pair<string, unsigned int>& fixed : FIXED_REGISTERS) {
+            state.registers.push_back(fixed.second);
+        }
+
+        for (string& word : context.words) {
+            state.words.push_back(isNumber(word) ? stoi(word) : i % 2 == 0 ? random() : (random() % 16 - 8) * 4);
+        }
+
+        state.hi = random();
+        state.lo = random();
+        state.seed = random();
+        tests.push_back(state);
+    }
+
+    return tests;
+}
+
+// Compares the state after a candidate with the state after the pattern. The
+// result has a bit set for each register that ends up different, or is -1
+// when memory, hi or lo differ or the candidate loads an address the pattern
+// does not touch
+long long compareStates(State& expected, State& actual) {
+    long long differences = 0;
+
+    if (expected.hi != actual.hi || expected.lo != actual.lo) {
+        return -1;
+    }
+
+    for (unsigned int address : actual.loads) {
+        if (find(expected.accesses.begin(), expected.accesses.end(), address) == expected.accesses.end()) {
+            return -1;
+        }
+    }
+
+    for (vector<pair<unsigned int, unsigned int>>* stores : { &expected.stores, &actual.stores }) {
+        for (pair<unsigned int, unsigned int>& store : *stores) {
+            if (loadWord(expected, store.first) != loadWord(actual, store.first)) {
+                return -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < expected.registers.size(); ++i) {
+        if (expected.registers.at(i) != actual.registers.at(i)) {
+            differences |= 1LL << i;
+        }
+    }
+
+    return differences;
+}
+
+// A symbolic value: a sum of atoms with coefficients modulo 2^32, plus a
+// constant. Atoms are inputs of the pattern or operations that are not linear,
+// named by their operands so that equal values get equal names
+struct Value {
+    map<string, unsigned int> terms;
+    unsigned int constant = 0;
+};
+
+Value constantValue(unsigned int constant) {
+    Value value;
+    value.constant = constant;
+
+    return value;
+}
+
+Value atomValue(string name) {
+    Value value;
+    value.terms[name] = 1;
+
+    return value;
+}
+
+bool isConstant(Value& value) {
+    return value.terms.empty();
+}
+
+string describe(Value& value) {
+    string description = to_string(value.constant);
+
+    for (pair<const string, unsigned int>& term : value.terms) {
+        description += "+" + to_string(term.second) + "*" + term.first;
+    }
+
+    return description;
+}
+
+Value combine(Value left, Value& right, unsigned int scale) {
+    left.constant += right.constant * scale;
+
+    for (pair<const string, unsigned int>& term : right.terms) {
+        if ((left.terms[term.first] += term.second * scale) == 0) {
+            left.terms.erase(term.first);
+        }
+    }
+
+    return left;
+}
+
+Value multiply(Value& value, unsigned int scale) {
+    return combine(constantValue(0), value, scale);
+}
+
+Value applyAtom(string name, Value& left, Value& right, bool isCommutative) {
+    string first = describe(left);
+    string second = describe(right);
+
+    if (isCommutative && second < first) {
+        swap(first, second);
+    }
+
+    return atomValue(name + "(" + first + "," + second + ")");
+}
+
+struct SymbolicState {
+    vector<Value> registers;
+    vector<Value> words;
+    Value hi = atomValue("hi");
+    Value lo = atomValue("lo");
+    vector<pair<Value, Value>> stores;
+    vector<string> accesses;
+    vector<string> loads;
+};
+
+// Reads memory through the stores so far. An address that may or may not be
+// the same as a stored one cannot be resolved, which fails the proof
+bool loadValue(SymbolicState& state, Value& address, Value& result) {
+    Value negative = multiply(address, -1u);
+
+    for (int i = state.stores.size() - 1; i >= 0; --i) {
+        Value difference = combine(state.stores.at(i).first, negative, 1);
+
+        if (!isConstant(difference)) {
+            return false;
+        } else if (difference.constant == 0) {
+            result = state.stores.at(i).second;
+            return true;
+        }
+    }
+
+    result = atomValue("m(" + describe(address) + ")");
+
+    return true;
+}
+
+bool evaluate(vector<Operation>& operations, SymbolicState& state) {
+    vector<Value>& registers = state.registers;
+
+    for (Operation& operation : operations) {
+        bool isProduct = operation.opcode == MULT || operation.opcode == MULTU || operation.opcode == DIV || operation.opcode == DIVU;
+        bool isArithmetic = operation.opcode == ADD || operation.opcode == SUB || operation.opcode == SLT || operation.opcode == SLTU;
+        Value left = isProduct ? registers.at(operation.first) : isArithmetic ? registers.at(operation.second) : Value();
+        Value right = isProduct ? registers.at(operation.second) : isArithmetic ? registers.at(operation.third) : Value();
+        bool isSigned = operation.opcode == SLT || operation.opcode == MULT || operation.opcode == DIV;
+
+        switch (operation.opcode) {
+            case ADD:
+                registers.at(operation.first) = combine(left, right, 1);
+                break;
+            case SUB:
+                registers.at(operation.first) = combine(left, right, -1u);
+                break;
+            case SLT:
+            case SLTU:
+                if (isConstant(left) && isConstant(right)) {
+                    registers.at(operation.first) = constantValue(isSigned ? static_cast<int>(left.constant) < static_cast<int>(right.constant)
+                        : left.constant < right.constant);
+                } else if (describe(left) == describe(right)) {
+                    registers.at(operation.first) = constantValue(0);
+                } else {
+                    registers.at(operation.first) = applyAtom(isSigned ? "slt" : "sltu", left, right, false);
+                }
+                break;
+            case MULT:
+            case MULTU:
+                if (isConstant(left) && isConstant(right)) {
+                    long long product = isSigned ? static_cast<long long>(static_cast<int>(left.constant)) * static_cast<int>(right.constant)
+                        : static_cast<long long>(static_cast<unsigned long long>(left.constant) * right.constant);
+                    state.hi = constantValue(static_cast<unsigned long long>(product) >> 32);
+                } else {
+                    state.hi = applyAtom(isSigned ? "multhi" : "multuhi", left, right, true);
+                }
+
+                // The low word of a product is the same signed or unsigned
+                state.lo = isConstant(left) ? multiply(right, left.constant) : isConstant(right) ? multiply(left, right.constant)
+                    : applyAtom("mult", left, right, true);
+                break;
+            case DIV:
+            case DIVU:
+                if (isConstant(left) && isConstant(right) && right.constant != 0) {
+                    long long dividend = isSigned ? static_cast<int>(left.constant) : left.constant;
+                    long long divisor = isSigned ? static_cast<int>(right.constant) : right.constant;
+                    state.lo = constantValue(dividend / divisor);
+                    state.hi = constantValue(dividend % divisor);
+                } else {
+                    state.lo = applyAtom(isSigned ? "div" : "divu", left, right, false);
+                    state.hi = applyAtom(isSigned ? "mod" : "modu", left, right, false);
+                }
+                break;
+            case MFLO:
+                registers.at(operation.first) = state.lo;
+                break;
+            case MFHI:
+                registers.at(operation.first) = state.hi;
+                break;
+            case LIS:
+                registers.at(operation.first) = state.words.at(operation.second);
+                break;
+            case LW:
+            case SW: {
+                Value address = combine(registers.at(operation.third), state.words.at(operation.second), 1);
+                state.accesses.push_back(describe(address));
+
+                if (operation.opcode == SW) {
+                    state.stores.push_back({ address, registers.at(operation.first) });
+                } else if (!loadValue(state, address, registers.at(operation.first))) {
+                    return false;
+                } else {
+                    state.loads.push_back(state.accesses.back());
+                }
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+SymbolicState createSymbolicState(Context& context) {
+    SymbolicState state;
+
+    for (string& name : context.registers) {
+        state.registers.push_back(atomValue(name));
+    }
+
+    for (const pair<string, unsigned int>& fixed : FIXED_REGISTERS) {
+        state.registers.push_back(constantValue(fixed.second));
+    }
+
+    for (string& word : context.words) {
+        state.words.push_back(isNumber(word) ? constantValue(stoi(word)) : atomValue(word));
+    }
+
+    return state;
+}
+
+// Proves that a candidate leaves the same memory, hi, lo and registers as the
+// pattern for every state, except for the registers in the mask
+bool proveEquivalent(vector<Operation>& pattern, vector<Operation>& candidate, Context& context, long long mask) {
+    SymbolicState expected = createSymbolicState(context);
+    SymbolicState actual = createSymbolicState(context);
+
+    if (!evaluate(pattern, expected) || !evaluate(candidate, actual)) {
+        return false;
+    } else if (describe(expected.hi) != describe(actual.hi) || describe(expected.lo) != describe(actual.lo)) {
+        return false;
+    }
+
+    for (string& address : actual.loads) {
+        if (find(expected.accesses.begin(), expected.accesses.end(), address) == expected.accesses.end()) {
+            return false;
+        }
+    }
+
+    for (vector<pair<Value, Value>>* stores : { &expected.stores, &actual.stores }) {
+        for (pair<Value, Value>& store : *stores) {
+            Value before;
+            Value after;
+
+            if (!loadValue(expected, store.first, before) || !loadValue(actual, store.first, after) || describe(before) != describe(after)) {
+                return false;
+            }
+        }
+    }
+
+    for (int i = 0; i < context.registers.size(); ++i) {
+        if ((mask & (1LL << i)) == 0 && describe(expected.registers.at(i)) != describe(actual.registers.at(i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Rule createRule(vector<MachineInstruction>& pattern, vector<Operation>& replacement, Context& context, long long mask) {
+    Rule rule;
+    rule.pattern = pattern;
+
+    for (Operation& operation : replacement) {
+        rule.replacement.push_back(encode(operation, context));
+    }
+
+    for (int i = 0; i < context.registers.size(); ++i) {
+        if (mask & (1LL << i)) {
+            rule.dead.push_back(context.registers.at(i));
+        }
+    }
+
+    return rule;
+}
+
+// Searches replacements of no instructions, then one and then two, that take
+// fewer words than the pattern. Candidates that agree with the pattern on all the
+// random states are proven in order of how few registers they clobber. The
+// cheapest proven replacement becomes a rule, and if it needs registers to be
+// dead, so does the cheapest one that needs none
+vector<Rule> searchPattern(vector<MachineInstruction>& pattern, Context& context) {
+    vector<Operation> operations;
+    vector<Operation> candidates = candidateOperations(context);
+    vector<State> tests = createTests(context);
+    vector<State> results = tests;
+    vector<Rule> rules;
+    bool isCheapestFound = false;
+
+    for (MachineInstruction& instruction : pattern) {
+        operations.push_back(decode(instruction, context));
+    }
+
+    for (State& result : results) {
+        execute(operations, result);
+    }
+
+    // Only registers whose last value in the pattern is read again inside it
+    // may be required dead, since anything else would be a rule for removing
+    // dead code
+    long long temporaries = 0;
+
+    for (int i = 0; i < pattern.size(); ++i) {
+        if (writtenRegister(pattern.at(i)) == "") {
+            continue;
+        }
+
+        for (int j = i + 1; j < pattern.size(); ++j) {
+            vector<string>& operands = pattern.at(j).operands;
+
+            for (int k = writtenRegister(pattern.at(j)) == "" ? 0 : 1; k < operands.size(); ++k) {
+                if (operands.at(k) == writtenRegister(pattern.at(i)) && !isWordOperand(pattern.at(j).opcode, k)) {
+                    temporaries |= 1LL << registerSlot(operands.at(k), context);
+                }
+            }
+
+            if (writtenRegister(pattern.at(j)) == writtenRegister(pattern.at(i))) {
+                temporaries &= ~(1LL << registerSlot(writtenRegister(pattern.at(j)), context));
+            }
+        }
+    }
+
+    int cost = instructionWords(operations);
+
+    for (int length = 0; length <= REPLACEMENT_LENGTH && length < cost; ++length) {
+        vector<pair<long long, vector<Operation>>> survivors;
+        vector<int> choice(length, 0);
+
+        while (survivors.size() < CANDIDATE_LIMIT) {
+            vector<Operation> candidate;
+
+            for (int index : choice) {
+                candidate.push_back(candidates.at(index));
+            }
+
+            if (instructionWords(candidate) < cost) {
+                long long mask = 0;
+
+                for (int i = 0; i < tests.size() && mask != -1; ++i) {
+                    State state = tests.at(i);
+                    execute(candidate, state);
+                    long long differences = compareStates(results.at(i), state);
+                    mask = differences == -1 ? -1 : mask | differences;
+                }
+
+                if (mask != -1 && (mask & ~temporaries) == 0) {
+                    survivors.push_back({ mask, candidate });
+                }
+            }
+
+            int position = length - 1;
+
+            while (position >= 0 && ++choice.at(position) == candidates.size()) {
+                choice.at(position--) = 0;
+            }
+
+            if (position < 0) {
+                break;
+            }
+        }
+
+        stable_sort(survivors.begin(), survivors.end(), [](const pair<long long, vector<Operation>>& left, const pair<long long, vector<Operation>>& right) {
+            return __builtin_popcountll(left.first) < __builtin_popcountll(right.first);
+        });
+
+        for (pair<long long, vector<Operation>>& survivor : survivors) {
+            if ((!isCheapestFound || survivor.first == 0) && proveEquivalent(operations, survivor.second, context, survivor.first)) {
+                rules.push_back(createRule(pattern, survivor.second, context, survivor.first));
+                isCheapestFound = true;
+
+                if (survivor.first == 0) {
+                    return rules;
+                }
+            }
+        }
+    }
+
+    return rules;
+}
+
+// Reads generated assembly from the files given, searches the most frequent
+// windows of straight-line code for cheaper equivalents and prints the rules
+// found in the format the generator loads with -fpeephole-rules
+int main(int argc, char* argv[]) {
+    map<string, pair<int, vector<MachineInstruction>>> patterns;
+
+    for (int i = 1; i < argc; ++i) {
+        for (vector<MachineInstruction>& run : readRuns(argv[i])) {
+            for (int start = 0; start < run.size(); ++start) {
+                for (int length = 2; length <= PATTERN_LENGTH && start + length <= run.size(); ++length) {
+                    vector<MachineInstruction> window(run.begin() + start, run.begin() + start + length);
+                    Context context;
+
+                    if (canonicalize(window, context)) {
+                        pair<int, vector<MachineInstruction>>& entry = patterns[renderAssembly(window)];
+                        entry.first += 1;
+                        entry.second = window;
+                    }
+                }
+            }
+        }
+    }
+
+    vector<pair<int, vector<MachineInstruction>>> frequent;
+
+    for (pair<const string, pair<int, vector<MachineInstruction>>>& pattern : patterns) {
+        if (pattern.second.first >= MINIMUM_OCCURRENCES) {
+            frequent.push_back(pattern.second);
+        }
+    }
+
+    stable_sort(frequent.begin(), frequent.end(), [](const pair<int, vector<MachineInstruction>>& left, const pair<int, vector<MachineInstruction>>& right) {
+        return left.first > right.first;
+    });
+
+    if (frequent.size() > PATTERN_LIMIT) {
+        frequent.resize(PATTERN_LIMIT);
+    }
+
+    vector<Rule> rules;
+    int improved = 0;
+
+    for (pair<int, vector<MachineInstruction>>& pattern : frequent) {
+        Context context;
+        canonicalize(pattern.second, context);
+        vector<Rule> found = searchPattern(pattern.second, context);
+
+        improved += !found.empty();
+        rules.insert(rules.end(), found.begin(), found.end());
+    }
+
+    cout << rules.size() << endl;
+
+    for (Rule& rule : rules) {
+        string pattern = renderAssembly(rule.pattern);
+        string replacement = renderAssembly(rule.replacement);
+
+        cout << count(pattern.begin(), pattern.end(), '\n') << " " << count(replacement.begin(), replacement.end(), '\n');
+
+        for (string& name : rule.dead) {
+            cout << " " << name;
+        }
+
+        cout << endl << pattern << replacement;
+    }
+
+    cerr << "superoptimizer: " << improved << " of " << frequent.size() << " patterns improved, " << rules.size() << " rules written" << endl;
+
+    return 0;
+}